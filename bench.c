@@ -0,0 +1,610 @@
+#include "utf8.h"
+#include "utf8_compact.h"
+#include "utf8_json.h"
+#include "utf8_pool.h"
+#include "utf8_position.h"
+#include "corpus.h"
+#include "perf_counters.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#define WARMUP_RUNS 3
+#define MEASURED_RUNS 31
+
+// keeps the compiler from optimizing the benchmarked calls away
+static volatile size_t sink;
+
+// Short fields, as in RPC messages, are cut out of every corpus to benchmark per-call overhead.
+#define FIELD_MIN_LEN 10
+#define FIELD_MAX_LEN 50
+
+typedef struct {
+    const char* name;
+    char* str;
+    size_t byte_len;
+    // the corpus itself if it is valid, otherwise a make_utf8_string_lossy copy, for trusted iteration
+    owned_utf8_string trusted;
+    // `trusted` escaped by escape_utf8_json, for unescaping
+    owned_utf8_string json;
+
+    // the corpus cut into consecutive fields of FIELD_MIN_LEN to FIELD_MAX_LEN bytes
+    const char** field_ptrs;
+    size_t* field_lens;
+    utf8_validity* field_validity;
+    size_t nfields;
+} corpus;
+
+typedef struct {
+    const char* name;
+    // runs the function once over the whole corpus and returns the number of bytes it examined
+    size_t (*run)(const corpus* c);
+} bench_fn;
+
+typedef struct {
+    const char* name;
+    unsigned weights[4];
+    utf8_cp_range two_byte_range; // { 0, 0 } keeps the generator's default
+    double invalid_rate;
+} corpus_profile;
+
+static const corpus_profile profiles[] = {
+    { "ascii",    { 1, 0, 0, 0 },   { 0, 0 },        0.0 },
+    { "latin",    { 85, 15, 0, 0 }, { 0xC0, 0x17F }, 0.0 },
+    { "cyrillic", { 15, 85, 0, 0 }, { 0, 0 },        0.0 },
+    { "cjk",      { 0, 0, 1, 0 },   { 0, 0 },        0.0 },
+    { "emoji",    { 0, 0, 0, 1 },   { 0, 0 },        0.0 },
+    { "invalid",  { 1, 1, 1, 1 },   { 0, 0 },        1.0 },
+};
+
+// Cuts the corpus into fields of uniformly distributed length. Fields end on character boundaries,
+// so they are as valid as the corpus itself.
+static bool make_fields(corpus* c, uint64_t seed) {
+    size_t cap = c->byte_len / FIELD_MIN_LEN + 1;
+    c->field_ptrs = malloc(cap * sizeof(const char*));
+    c->field_lens = malloc(cap * sizeof(size_t));
+    c->field_validity = malloc(cap * sizeof(utf8_validity));
+    c->nfields = 0;
+    if (!c->field_ptrs || !c->field_lens || !c->field_validity) return false;
+
+    uint64_t state = seed | 1;
+    for (size_t start = 0; start < c->byte_len;) {
+        // xorshift64
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        size_t end = start + FIELD_MIN_LEN + state % (FIELD_MAX_LEN - FIELD_MIN_LEN + 1);
+        if (end > c->byte_len) end = c->byte_len;
+        for (int i = 0; i < 3 && end < c->byte_len && ((uint8_t)c->str[end] & 0b11000000) == 0b10000000; i++) end++;
+
+        c->field_ptrs[c->nfields] = c->str + start;
+        c->field_lens[c->nfields] = end - start;
+        c->nfields++;
+        start = end;
+    }
+    return true;
+}
+
+typedef struct {
+    char* dst;
+    const char* src;
+    size_t len;
+} copy_job;
+
+static void copy_chunk(void* arg) {
+    copy_job* job = arg;
+    memcpy(job->dst, job->src, job->len);
+}
+
+// Copies the corpus into fresh pages first touched by the shared pool's workers, which spreads them over the
+// NUMA nodes like a buffer filled in parallel would be. Otherwise the whole corpus would sit on one node.
+static void spread_over_nodes(corpus* c) {
+    size_t workers = utf8_pool_threads(NULL);
+    if (utf8_pool_nodes(NULL) < 2 || workers == 0) return;
+
+    char* spread = malloc(c->byte_len + 1);
+    copy_job* jobs = malloc(workers * sizeof(copy_job));
+    if (!spread || !jobs) {
+        free(spread);
+        free(jobs);
+        return;
+    }
+
+    size_t chunk_len = c->byte_len / workers;
+    for (size_t i = 0; i < workers; i++) {
+        size_t start = i * chunk_len;
+        jobs[i] = (copy_job) { .dst = spread + start, .src = c->str + start, .len = i == workers - 1 ? c->byte_len + 1 - start : chunk_len };
+    }
+    run_utf8_pool_tasks(NULL, copy_chunk, jobs, sizeof(copy_job), workers);
+
+    free(jobs);
+    free(c->str);
+    c->str = spread;
+}
+
+static void free_corpus(corpus* c) {
+    if (c->trusted.str != c->str) free_owned_utf8_string(&c->trusted);
+    free_owned_utf8_string(&c->json);
+    free(c->str);
+    free(c->field_ptrs);
+    free(c->field_lens);
+    free(c->field_validity);
+}
+
+static corpus make_corpus(const char* name, utf8_corpus_config config) {
+    utf8_corpus generated = make_utf8_corpus(config);
+    corpus c = { .name = name, .str = generated.str, .byte_len = generated.byte_len };
+    if (c.str) spread_over_nodes(&c);
+    if (c.str) {
+        if (validate_utf8_n(c.str, c.byte_len).valid) c.trusted = (owned_utf8_string) { .str = c.str, .byte_len = c.byte_len };
+        else c.trusted = make_utf8_string_lossy(c.str);
+    }
+    if (c.str && c.trusted.str) c.json = escape_utf8_json(c.trusted.str, c.trusted.byte_len, false).str;
+    if (c.str && (!c.trusted.str || !c.json.str || !make_fields(&c, config.seed))) {
+        free_corpus(&c);
+        c = (corpus) { .name = name };
+    }
+    return c;
+}
+
+static size_t run_validate_utf8(const corpus* c) {
+    utf8_validity validity = validate_utf8(c->str);
+    sink = validity.valid_upto;
+    return validity.valid ? validity.valid_upto : validity.valid_upto + 1;
+}
+
+static size_t run_validate_utf8_n(const corpus* c) {
+    utf8_validity validity = validate_utf8_n(c->str, c->byte_len);
+    sink = validity.valid_upto;
+    return validity.valid ? validity.valid_upto : validity.valid_upto + 1;
+}
+
+static size_t run_validate_utf8_n_fields(const corpus* c) {
+    size_t valid = 0;
+    for (size_t i = 0; i < c->nfields; i++) valid += validate_utf8_n(c->field_ptrs[i], c->field_lens[i]).valid;
+    sink = valid;
+    return c->byte_len;
+}
+
+static size_t run_validate_utf8_batch(const corpus* c) {
+    validate_utf8_batch(c->field_ptrs, c->field_lens, c->nfields, c->field_validity);
+    if (c->nfields == 0) return c->byte_len;
+    sink = c->field_validity[c->nfields - 1].valid_upto;
+    return c->byte_len;
+}
+
+static size_t run_validate_utf8_parallel(const corpus* c) {
+    utf8_validity validity = validate_utf8_parallel(NULL, c->str, c->byte_len);
+    sink = validity.valid_upto;
+    return validity.valid ? validity.valid_upto : validity.valid_upto + 1;
+}
+
+// same chunks, scheduled without regard to the NUMA node holding them
+static utf8_pool* naive_pool;
+
+static size_t run_validate_utf8_parallel_naive(const corpus* c) {
+    utf8_validity validity = validate_utf8_parallel(naive_pool, c->str, c->byte_len);
+    sink = validity.valid_upto;
+    return validity.valid ? validity.valid_upto : validity.valid_upto + 1;
+}
+
+static size_t run_make_utf8_string_lossy(const corpus* c) {
+    owned_utf8_string owned_ustr = make_utf8_string_lossy(c->str);
+    sink = owned_ustr.byte_len;
+    free_owned_utf8_string(&owned_ustr);
+    return c->byte_len;
+}
+
+static size_t run_make_utf8_compact_string(const corpus* c) {
+    utf8_compact_string cs = make_utf8_compact_string((utf8_string) { .str = c->trusted.str, .byte_len = c->trusted.byte_len });
+    sink = cs.length;
+    free_utf8_compact_string(&cs);
+    return c->trusted.byte_len;
+}
+
+static size_t run_escape_utf8_json(const corpus* c) {
+    utf8_json_result r = escape_utf8_json(c->str, c->byte_len, false);
+    sink = r.str.byte_len;
+    free_owned_utf8_string(&r.str);
+    return r.validity.valid ? c->byte_len : r.validity.valid_upto + 1;
+}
+
+static size_t run_escape_utf8_json_ascii(const corpus* c) {
+    utf8_json_result r = escape_utf8_json(c->str, c->byte_len, true);
+    sink = r.str.byte_len;
+    free_owned_utf8_string(&r.str);
+    return r.validity.valid ? c->byte_len : r.validity.valid_upto + 1;
+}
+
+static size_t run_unescape_utf8_json(const corpus* c) {
+    utf8_json_result r = unescape_utf8_json(c->json.str, c->json.byte_len);
+    sink = r.str.byte_len;
+    free_owned_utf8_string(&r.str);
+    return c->json.byte_len;
+}
+
+static size_t run_diagnose_utf8(const corpus* c) {
+    utf8_error_report report = diagnose_utf8(c->str);
+    sink = report.total_errors;
+    return report.byte_len;
+}
+
+static size_t run_scan_utf8_text(const corpus* c) {
+    utf8_text_stats stats = scan_utf8_text(c->str, c->byte_len);
+    sink = stats.char_count + stats.line_count;
+    return stats.validity.valid ? stats.validity.valid_upto : stats.validity.valid_upto + 1;
+}
+
+static size_t run_utf8_char_count(const corpus* c) {
+    sink = utf8_char_count((utf8_string) { .str = c->str, .byte_len = c->byte_len });
+    return c->byte_len;
+}
+
+static size_t run_utf8_char_count_parallel(const corpus* c) {
+    sink = utf8_char_count_parallel(NULL, (utf8_string) { .str = c->str, .byte_len = c->byte_len });
+    return c->byte_len;
+}
+
+static size_t run_utf8_char_count_parallel_naive(const corpus* c) {
+    sink = utf8_char_count_parallel(naive_pool, (utf8_string) { .str = c->str, .byte_len = c->byte_len });
+    return c->byte_len;
+}
+
+static size_t run_nth_utf8_char(const corpus* c) {
+    // an out of bounds index forces a walk over the whole string
+    utf8_char ch = nth_utf8_char((utf8_string) { .str = c->str, .byte_len = c->byte_len }, (size_t)-1);
+    sink = ch.byte_len;
+    return c->byte_len;
+}
+
+static size_t run_utf8_char_index_of(const corpus* c) {
+    // the offset of the end counts the characters of the whole string
+    sink = utf8_char_index_of((utf8_string) { .str = c->str, .byte_len = c->byte_len }, c->byte_len);
+    return c->byte_len;
+}
+
+static size_t run_next_utf8_char(const corpus* c) {
+    utf8_char_iter iter = make_utf8_char_iter((utf8_string) { .str = c->str, .byte_len = c->byte_len });
+
+    size_t total = 0;
+    utf8_char ch;
+    while ((ch = next_utf8_char(&iter)).byte_len > 0) total += ch.byte_len;
+
+    sink = total;
+    return c->byte_len;
+}
+
+static size_t run_next_utf8_lossy_char(const corpus* c) {
+    utf8_lossy_iter iter = make_utf8_lossy_iter(c->str, c->byte_len);
+
+    size_t total = 0;
+    utf8_char ch;
+    while ((ch = next_utf8_lossy_char(&iter)).byte_len > 0) total += ch.byte_len;
+
+    sink = total;
+    return c->byte_len;
+}
+
+static size_t run_utf8_position_at_utf16(const corpus* c) {
+    // an offset beyond the end counts the UTF-16 code units of the whole string
+    utf8_position pos = utf8_position_at_utf16((utf8_string) { .str = c->trusted.str, .byte_len = c->trusted.byte_len }, (size_t)-1);
+    sink = pos.utf16_offset;
+    return c->trusted.byte_len;
+}
+
+// iteration policies of utf8.hpp (bench_iter.cpp): sum the code points of every character,
+// and set `stop` to where iteration ended
+uint64_t sum_code_points_trusted(const char* str, size_t byte_len, size_t* stop);
+uint64_t sum_code_points_checked(const char* str, size_t byte_len, size_t* stop);
+uint64_t sum_code_points_lossy(const char* str, size_t byte_len, size_t* stop);
+
+static size_t run_chars_trusted(const corpus* c) {
+    size_t stop;
+    sink = sum_code_points_trusted(c->trusted.str, c->trusted.byte_len, &stop);
+    return stop;
+}
+
+static size_t run_chars_checked(const corpus* c) {
+    size_t stop;
+    sink = sum_code_points_checked(c->str, c->byte_len, &stop);
+    return stop < c->byte_len ? stop + 1 : stop;
+}
+
+static size_t run_chars_lossy(const corpus* c) {
+    size_t stop;
+    sink = sum_code_points_lossy(c->str, c->byte_len, &stop);
+    return stop;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile over a sorted array
+static double percentile(const double* sorted, size_t n, double p) {
+    size_t rank = (size_t)(p / 100.0 * (double)(n - 1) + 0.5);
+    return sorted[rank];
+}
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON,
+} output_format;
+
+typedef struct {
+    const char* function;
+    const char* corpus;
+    size_t bytes;             // bytes examined by one run
+    double mbps_p50;
+    double mbps_p10;          // slowest 10% of runs
+    double mbps_p90;          // fastest 10% of runs
+    double cycles_per_byte;   // median, negative when no cycle counter is available
+    // from hardware counters over all measured runs, negative when the counters are unavailable
+    double ipc;
+    double branch_miss_pct;   // mispredicted branches per 100 branches
+    double l1d_miss_per_kb;   // L1 data cache read misses per 1024 examined bytes
+} bench_result;
+
+static perf_counters counters;
+
+// ISA level of the machine the benchmark runs on, so results from different hosts are not compared blindly
+static const char* cpu_tier(void) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        return "x86-64-v4";
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("fma"))
+        return "x86-64-v3";
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        return "x86-64-v2";
+    return "x86-64";
+#elif defined(__aarch64__)
+    return "aarch64";
+#else
+    return "generic";
+#endif
+}
+
+static bench_result bench(const bench_fn* fn, const corpus* c) {
+    size_t bytes = 0;
+    for (int i = 0; i < WARMUP_RUNS; i++) bytes = fn->run(c);
+
+    double ns[MEASURED_RUNS];
+    double cycles[MEASURED_RUNS];
+    perf_sample total = { 0 };
+    for (int i = 0; i < MEASURED_RUNS; i++) {
+        // counters are collected around every run, so the timer calls themselves are not counted
+        start_perf_counters(&counters);
+        uint64_t c0 = now_cycles();
+        uint64_t t0 = now_ns();
+        fn->run(c);
+        uint64_t t1 = now_ns();
+        uint64_t c1 = now_cycles();
+        perf_sample sample = stop_perf_counters(&counters);
+        for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+            total.value[k] += sample.value[k];
+            total.available[k] = sample.available[k];
+        }
+        ns[i] = (double)(t1 - t0);
+        cycles[i] = (double)(c1 - c0);
+    }
+
+    qsort(ns, MEASURED_RUNS, sizeof(double), cmp_double);
+    qsort(cycles, MEASURED_RUNS, sizeof(double), cmp_double);
+
+    double total_bytes = (double)bytes * MEASURED_RUNS;
+
+    // bytes per nanosecond == gigabytes per second, report MB/s
+    return (bench_result) {
+        .function = fn->name,
+        .corpus = c->name,
+        .bytes = bytes,
+        .mbps_p50 = (double)bytes / percentile(ns, MEASURED_RUNS, 50) * 1000.0,
+        .mbps_p10 = (double)bytes / percentile(ns, MEASURED_RUNS, 90) * 1000.0,
+        .mbps_p90 = (double)bytes / percentile(ns, MEASURED_RUNS, 10) * 1000.0,
+#ifdef HAVE_RDTSC
+        .cycles_per_byte = percentile(cycles, MEASURED_RUNS, 50) / (double)bytes,
+#else
+        .cycles_per_byte = -1,
+#endif
+        .ipc = total.available[PERF_CYCLES] && total.available[PERF_INSTRUCTIONS] && total.value[PERF_CYCLES]
+            ? (double)total.value[PERF_INSTRUCTIONS] / (double)total.value[PERF_CYCLES] : -1,
+        .branch_miss_pct = total.available[PERF_BRANCHES] && total.available[PERF_BRANCH_MISSES] && total.value[PERF_BRANCHES]
+            ? (double)total.value[PERF_BRANCH_MISSES] * 100.0 / (double)total.value[PERF_BRANCHES] : -1,
+        .l1d_miss_per_kb = total.available[PERF_L1D_READ_MISSES]
+            ? (double)total.value[PERF_L1D_READ_MISSES] * 1024.0 / total_bytes : -1,
+    };
+}
+
+// prints `value` with `format`, or `missing` with `missing_format` when the metric is unavailable (negative)
+static void print_metric(const char* format, double value, const char* missing_format, const char* missing) {
+    if (value >= 0) printf(format, value);
+    else printf(missing_format, missing);
+}
+
+static void report_begin(output_format format) {
+    switch (format) {
+    case FORMAT_TEXT:
+        printf("%d warmup + %d measured runs per case, MB/s percentiles are over run times, cpu tier %s\n",
+            WARMUP_RUNS, MEASURED_RUNS, cpu_tier());
+        printf("%-30s %-10s %10s %10s %10s %10s %10s %6s %9s %9s\n",
+            "function", "corpus", "bytes", "MB/s p50", "MB/s p10", "MB/s p90", "cyc/B p50", "IPC", "br-miss%", "L1d-m/KB");
+        break;
+    case FORMAT_CSV:
+        printf("function,corpus,bytes,mbps_p50,mbps_p10,mbps_p90,cycles_per_byte,ipc,branch_miss_pct,l1d_miss_per_kb,cpu_tier\n");
+        break;
+    case FORMAT_JSON:
+        printf("[");
+        break;
+    }
+}
+
+static void report_row(output_format format, const bench_result* r, bool first) {
+    switch (format) {
+    case FORMAT_TEXT:
+        printf("%-30s %-10s %10zu %10.1f %10.1f %10.1f", r->function, r->corpus, r->bytes, r->mbps_p50, r->mbps_p10, r->mbps_p90);
+        print_metric(" %10.3f", r->cycles_per_byte, " %10s", "n/a");
+        print_metric(" %6.2f", r->ipc, " %6s", "n/a");
+        print_metric(" %9.3f", r->branch_miss_pct, " %9s", "n/a");
+        print_metric(" %9.2f", r->l1d_miss_per_kb, " %9s", "n/a");
+        printf("\n");
+        break;
+    case FORMAT_CSV:
+        printf("%s,%s,%zu,%.3f,%.3f,%.3f,", r->function, r->corpus, r->bytes, r->mbps_p50, r->mbps_p10, r->mbps_p90);
+        print_metric("%.4f", r->cycles_per_byte, "%s", "");
+        print_metric(",%.3f", r->ipc, ",%s", "");
+        print_metric(",%.4f", r->branch_miss_pct, ",%s", "");
+        print_metric(",%.3f", r->l1d_miss_per_kb, ",%s", "");
+        printf(",%s\n", cpu_tier());
+        break;
+    case FORMAT_JSON:
+        printf("%s\n  {\"function\": \"%s\", \"corpus\": \"%s\", \"bytes\": %zu, "
+            "\"mbps_p50\": %.3f, \"mbps_p10\": %.3f, \"mbps_p90\": %.3f, \"cycles_per_byte\": ",
+            first ? "" : ",", r->function, r->corpus, r->bytes, r->mbps_p50, r->mbps_p10, r->mbps_p90);
+        print_metric("%.4f", r->cycles_per_byte, "%s", "null");
+        print_metric(", \"ipc\": %.3f", r->ipc, ", \"ipc\": %s", "null");
+        print_metric(", \"branch_miss_pct\": %.4f", r->branch_miss_pct, ", \"branch_miss_pct\": %s", "null");
+        print_metric(", \"l1d_miss_per_kb\": %.3f", r->l1d_miss_per_kb, ", \"l1d_miss_per_kb\": %s", "null");
+        printf(", \"cpu_tier\": \"%s\"}", cpu_tier());
+        break;
+    }
+    fflush(stdout);
+}
+
+static void report_end(output_format format) {
+    if (format == FORMAT_JSON) printf("\n]\n");
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [-f text|csv|json] [-n bytes] [-s seed] [-w w1,w2,w3,w4] [-e invalid_rate]\n"
+        "\n"
+        "  -f format         output format (default text), compare csv runs with benchcmp\n"
+        "  -n bytes          size of every corpus, accepts K/M/G suffixes (default 1M)\n"
+        "  -s seed           seed of the corpus generator (default 0)\n"
+        "  -w w1,w2,w3,w4    adds a 'custom' corpus with these weights of 1/2/3/4 byte characters\n"
+        "  -e invalid_rate   invalid sequence rate of the 'custom' corpus\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    // -n and -s apply to every corpus, -w and -e describe the 'custom' one
+    utf8_corpus_config custom = default_utf8_corpus_config();
+    bool has_custom = false;
+    output_format format = FORMAT_TEXT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, UTF8_CORPUS_GETOPT "f:")) != -1) {
+        if (opt == 'f') {
+            if (strcmp(optarg, "text") == 0) format = FORMAT_TEXT;
+            else if (strcmp(optarg, "csv") == 0) format = FORMAT_CSV;
+            else if (strcmp(optarg, "json") == 0) format = FORMAT_JSON;
+            else {
+                usage(argv[0]);
+                return 2;
+            }
+            continue;
+        }
+        if (opt == 'w' || opt == 'e') has_custom = true;
+        if (!parse_utf8_corpus_option(&custom, opt, optarg)) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // before any pool thread starts (the corpora are copied by the shared pool), so the counters include them
+    counters = open_perf_counters();
+
+    size_t nprofiles = sizeof(profiles) / sizeof(profiles[0]);
+    size_t ncorpora = nprofiles + has_custom;
+    corpus corpora[sizeof(profiles) / sizeof(profiles[0]) + 1];
+
+    for (size_t i = 0; i < nprofiles; i++) {
+        utf8_corpus_config config = default_utf8_corpus_config();
+        config.seed = custom.seed;
+        config.byte_len = custom.byte_len;
+        memcpy(config.weights, profiles[i].weights, sizeof(config.weights));
+        if (profiles[i].two_byte_range.last) config.ranges[1] = profiles[i].two_byte_range;
+        config.invalid_rate = profiles[i].invalid_rate;
+        corpora[i] = make_corpus(profiles[i].name, config);
+    }
+    if (has_custom) corpora[nprofiles] = make_corpus("custom", custom);
+
+    const bench_fn fns[] = {
+        { "validate_utf8", run_validate_utf8 },
+        { "validate_utf8_n", run_validate_utf8_n },
+        { "validate_utf8_n_fields", run_validate_utf8_n_fields },
+        { "validate_utf8_batch", run_validate_utf8_batch },
+        { "validate_utf8_parallel", run_validate_utf8_parallel },
+        { "validate_utf8_parallel_naive", run_validate_utf8_parallel_naive },
+        { "make_utf8_string_lossy", run_make_utf8_string_lossy },
+        { "make_utf8_compact_string", run_make_utf8_compact_string },
+        { "escape_utf8_json", run_escape_utf8_json },
+        { "escape_utf8_json_ascii", run_escape_utf8_json_ascii },
+        { "unescape_utf8_json", run_unescape_utf8_json },
+        { "diagnose_utf8", run_diagnose_utf8 },
+        { "scan_utf8_text", run_scan_utf8_text },
+        { "utf8_char_count", run_utf8_char_count },
+        { "utf8_char_count_parallel", run_utf8_char_count_parallel },
+        { "utf8_char_count_parallel_naive", run_utf8_char_count_parallel_naive },
+        { "nth_utf8_char", run_nth_utf8_char },
+        { "utf8_char_index_of", run_utf8_char_index_of },
+        { "next_utf8_char", run_next_utf8_char },
+        { "next_utf8_lossy_char", run_next_utf8_lossy_char },
+        { "utf8_position_at_utf16", run_utf8_position_at_utf16 },
+        { "utf8::chars<trusted>", run_chars_trusted },
+        { "utf8::chars<checked>", run_chars_checked },
+        { "utf8::chars<lossy>", run_chars_lossy },
+    };
+    size_t nfns = sizeof(fns) / sizeof(fns[0]);
+
+    for (size_t i = 0; i < ncorpora; i++) {
+        if (!corpora[i].str) {
+            fprintf(stderr, "cannot generate corpus '%s' (bad weights or out of memory)\n", corpora[i].name);
+            return 1;
+        }
+    }
+
+    naive_pool = make_utf8_pool((utf8_pool_config) { .threads = utf8_pool_threads(NULL), .ignore_numa = true });
+
+    report_begin(format);
+    for (size_t f = 0; f < nfns; f++) {
+        for (size_t i = 0; i < ncorpora; i++) {
+            bench_result r = bench(&fns[f], &corpora[i]);
+            report_row(format, &r, f == 0 && i == 0);
+        }
+    }
+    report_end(format);
+
+    close_perf_counters(&counters);
+    free_utf8_pool(naive_pool);
+
+    for (size_t i = 0; i < ncorpora; i++) free_corpus(&corpora[i]);
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+// Benchmark bodies for the iteration policies of utf8.hpp, called from bench.c.
+
+#include "utf8.hpp"
+
+template<typename Policy>
+static uint64_t sum_code_points(const char* str, size_t byte_len, size_t* stop) {
+    auto chars = utf8::chars<Policy>(std::string_view(str, byte_len));
+    auto it = chars.begin();
+
+    uint64_t sum = 0;
+    for (; it != chars.end(); ++it) sum += (*it).code_point();
+
+    *stop = static_cast<size_t>(it.base() - str);
+    return sum;
+}
+
+extern "C" uint64_t sum_code_points_trusted(const char* str, size_t byte_len, size_t* stop) {
+    return sum_code_points<utf8::trusted>(str, byte_len, stop);
+}
+
+extern "C" uint64_t sum_code_points_checked(const char* str, size_t byte_len, size_t* stop) {
+    return sum_code_points<utf8::checked>(str, byte_len, stop);
+}
+
+extern "C" uint64_t sum_code_points_lossy(const char* str, size_t byte_len, size_t* stop) {
+    return sum_code_points<utf8::lossy>(str, byte_len, stop);
+}
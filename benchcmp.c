@@ -0,0 +1,201 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_LINE 1024
+#define MAX_FIELDS 32
+
+typedef struct {
+    char function[64];
+    char corpus[64];
+    char cpu_tier[32];
+    double mbps;
+    double mbps_slow;   // 10th percentile, 0 when the run has no spread columns
+    double mbps_fast;   // 90th percentile
+} row;
+
+typedef struct {
+    row* rows;
+    size_t len;
+} run;
+
+// splits `line` in place on ',' and returns the number of fields
+static size_t split_csv(char* line, char** fields) {
+    size_t n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+
+    fields[n++] = line;
+    for (char* p = line; *p && n < MAX_FIELDS; p++) {
+        if (*p == ',') {
+            *p = '\0';
+            fields[n++] = p + 1;
+        }
+    }
+    return n;
+}
+
+static int column(char** header, size_t n, const char* name) {
+    for (size_t i = 0; i < n; i++)
+        if (strcmp(header[i], name) == 0) return (int)i;
+    return -1;
+}
+
+// Reads a csv produced by `utf8_bench -f csv`. Columns are looked up by name so extra columns are ignored.
+static bool read_run(const char* path, run* out) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    char line[MAX_LINE];
+    char* fields[MAX_FIELDS];
+
+    if (!fgets(line, sizeof(line), f)) {
+        fprintf(stderr, "%s: empty file\n", path);
+        fclose(f);
+        return false;
+    }
+
+    size_t nheader = split_csv(line, fields);
+    int function_col = column(fields, nheader, "function");
+    int corpus_col = column(fields, nheader, "corpus");
+    int mbps_col = column(fields, nheader, "mbps_p50");
+    int slow_col = column(fields, nheader, "mbps_p10");
+    int fast_col = column(fields, nheader, "mbps_p90");
+    int tier_col = column(fields, nheader, "cpu_tier");
+    if (function_col < 0 || corpus_col < 0 || mbps_col < 0) {
+        fprintf(stderr, "%s: missing function, corpus or mbps_p50 column\n", path);
+        fclose(f);
+        return false;
+    }
+
+    size_t cap = 64;
+    out->rows = malloc(cap * sizeof(row));
+    out->len = 0;
+    if (!out->rows) {
+        fclose(f);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        size_t n = split_csv(line, fields);
+        if (n < nheader) continue;
+
+        if (out->len == cap) {
+            row* grown = realloc(out->rows, (cap *= 2) * sizeof(row));
+            if (!grown) {
+                fclose(f);
+                return false;
+            }
+            out->rows = grown;
+        }
+
+        row* r = &out->rows[out->len++];
+        snprintf(r->function, sizeof(r->function), "%s", fields[function_col]);
+        snprintf(r->corpus, sizeof(r->corpus), "%s", fields[corpus_col]);
+        snprintf(r->cpu_tier, sizeof(r->cpu_tier), "%s", tier_col >= 0 ? fields[tier_col] : "");
+        r->mbps = strtod(fields[mbps_col], NULL);
+        r->mbps_slow = slow_col >= 0 ? strtod(fields[slow_col], NULL) : 0;
+        r->mbps_fast = fast_col >= 0 ? strtod(fields[fast_col], NULL) : 0;
+    }
+
+    fclose(f);
+    return true;
+}
+
+static const row* find(const run* r, const row* key) {
+    for (size_t i = 0; i < r->len; i++)
+        if (strcmp(r->rows[i].function, key->function) == 0 && strcmp(r->rows[i].corpus, key->corpus) == 0)
+            return &r->rows[i];
+    return NULL;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [-t threshold_percent] baseline.csv candidate.csv\n"
+        "\n"
+        "Compares median throughput of two `utf8_bench -f csv` runs and exits with 1\n"
+        "if any case got slower by more than the threshold (default 5%%),\n"
+        "or if a case of the baseline is missing from the candidate.\n"
+        "A slowdown only counts when the runs' 10th-90th percentile ranges do not overlap,\n"
+        "otherwise it is reported as noise.\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    double threshold = 5.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't') {
+            char* end;
+            threshold = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || !(threshold >= 0)) {
+                fprintf(stderr, "%s: bad threshold '%s'\n", argv[0], optarg);
+                return 2;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    run baseline, candidate;
+    if (!read_run(argv[optind], &baseline) || !read_run(argv[optind + 1], &candidate)) return 2;
+
+    size_t regressions = 0;
+    bool tier_mismatch = false;
+
+    printf("%-30s %-10s %12s %12s %9s\n", "function", "corpus", "base MB/s", "new MB/s", "delta");
+    for (size_t i = 0; i < candidate.len; i++) {
+        const row* now = &candidate.rows[i];
+        const row* before = find(&baseline, now);
+        if (!before) {
+            printf("%-30s %-10s %12s %12.1f %9s  new\n", now->function, now->corpus, "-", now->mbps, "-");
+            continue;
+        }
+
+        if (strcmp(before->cpu_tier, now->cpu_tier) != 0) tier_mismatch = true;
+
+        double delta = before->mbps > 0 ? (now->mbps - before->mbps) / before->mbps * 100.0 : 0.0;
+        const char* verdict = "";
+        if (delta < -threshold) {
+            // the fastest candidate run still has to be slower than the slowest baseline run
+            bool has_spread = before->mbps_slow > 0 && now->mbps_fast > 0;
+            if (!has_spread || now->mbps_fast < before->mbps_slow) {
+                verdict = "  REGRESSION";
+                regressions++;
+            } else {
+                verdict = "  noise";
+            }
+        } else if (delta > threshold) {
+            verdict = "  improved";
+        }
+
+        printf("%-30s %-10s %12.1f %12.1f %+8.1f%%%s\n", now->function, now->corpus, before->mbps, now->mbps, delta, verdict);
+    }
+
+    // a case that crashed, or was renamed or removed, must not pass unnoticed
+    size_t missing = 0;
+    for (size_t i = 0; i < baseline.len; i++) {
+        const row* before = &baseline.rows[i];
+        if (find(&candidate, before)) continue;
+        printf("%-30s %-10s %12.1f %12s %9s  MISSING\n", before->function, before->corpus, before->mbps, "-", "-");
+        missing++;
+    }
+
+    if (tier_mismatch) printf("\nwarning: runs were taken on different cpu tiers\n");
+    printf("\n%zu regression(s) beyond %.1f%%\n", regressions, threshold);
+    if (missing > 0) printf("%zu case(s) of the baseline missing from the candidate\n", missing);
+
+    free(baseline.rows);
+    free(candidate.rows);
+    return regressions > 0 || missing > 0 ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+#include "corpus.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t state;
+} rng;
+
+static uint64_t rng_next(rng* r) {
+    // splitmix64
+    uint64_t z = (r->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint32_t rng_range(rng* r, uint32_t first, uint32_t last) {
+    return first + (uint32_t)(rng_next(r) % ((uint64_t)last - first + 1));
+}
+
+static double rng_unit(rng* r) {
+    return (double)(rng_next(r) >> 11) / (double)(1ULL << 53);
+}
+
+static size_t encode_utf8(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+static char continuation_byte(rng* r) {
+    return (char)(0x80 | (rng_next(r) & 0x3F));
+}
+
+// Writes one invalid sequence into `out` and returns its length.
+// `allow_stray` is false right after a truncated sequence, since a stray continuation byte would complete it.
+static size_t encode_invalid(rng* r, bool allow_stray, bool* truncated, char* out) {
+    *truncated = false;
+
+    switch (rng_next(r) % 5) {
+    case 0: // stray continuation byte
+        if (allow_stray) {
+            out[0] = continuation_byte(r);
+            return 1;
+        }
+        // fallthrough
+    case 1: // truncated 3-byte sequence
+        out[0] = (char)rng_range(r, 0xE1, 0xEC);
+        out[1] = continuation_byte(r);
+        *truncated = true;
+        return 2;
+    case 2: // overlong 2-byte encoding of ASCII
+        out[0] = (char)rng_range(r, 0xC0, 0xC1);
+        out[1] = continuation_byte(r);
+        return 2;
+    case 3: // UTF-16 surrogate
+        out[0] = (char)0xED;
+        out[1] = (char)rng_range(r, 0xA0, 0xBF);
+        out[2] = continuation_byte(r);
+        return 3;
+    default: // lead byte of the obsolete 5 and 6 byte forms
+        out[0] = (char)rng_range(r, 0xF8, 0xFF);
+        return 1;
+    }
+}
+
+static bool range_fits(utf8_cp_range range, size_t byte_len) {
+    static const uint32_t min_cp[4] = { 0x01, 0x80, 0x800, 0x10000 };
+    static const uint32_t max_cp[4] = { 0x7F, 0x7FF, 0xFFFF, 0x10FFFF };
+
+    if (range.first > range.last) return false;
+    if (range.first < min_cp[byte_len - 1] || range.last > max_cp[byte_len - 1]) return false;
+
+    // a 3-byte range made only of surrogates has nothing to draw from
+    if (byte_len == 3 && range.first >= 0xD800 && range.last <= 0xDFFF) return false;
+
+    return true;
+}
+
+utf8_corpus_config default_utf8_corpus_config(void) {
+    return (utf8_corpus_config) {
+        .seed = 0,
+        .byte_len = 1 << 20,
+        .weights = { 1, 0, 0, 0 },
+        .ranges = {
+            { 0x20, 0x7E },         // printable ASCII
+            { 0x400, 0x4FF },       // Cyrillic
+            { 0x4E00, 0x9FFF },     // CJK Unified Ideographs
+            { 0x1F600, 0x1F64F },   // Emoticons
+        },
+        .invalid_rate = 0.0,
+    };
+}
+
+utf8_corpus make_utf8_corpus(utf8_corpus_config config) {
+    unsigned total_weight = 0;
+    for (size_t i = 0; i < 4; i++) {
+        if (config.weights[i] == 0) continue;
+        if (!range_fits(config.ranges[i], i + 1)) return (utf8_corpus) { .str = NULL, .byte_len = 0 };
+        total_weight += config.weights[i];
+    }
+    if (total_weight == 0) return (utf8_corpus) { .str = NULL, .byte_len = 0 };
+
+    char* str = malloc(config.byte_len + 1);
+    if (!str) return (utf8_corpus) { .str = NULL, .byte_len = 0 }; // failed allocation
+
+    rng r = { .state = config.seed };
+    bool truncated = false;
+    size_t len = 0;
+    char buf[4];
+
+    while (1) {
+        size_t n;
+
+        if (config.invalid_rate > 0 && rng_unit(&r) < config.invalid_rate) {
+            n = encode_invalid(&r, !truncated, &truncated, buf);
+        } else {
+            unsigned pick = (unsigned)(rng_next(&r) % total_weight);
+            size_t class = 0;
+            while (pick >= config.weights[class]) pick -= config.weights[class++];
+
+            uint32_t cp;
+            do cp = rng_range(&r, config.ranges[class].first, config.ranges[class].last);
+            while (cp >= 0xD800 && cp <= 0xDFFF);
+
+            n = encode_utf8(cp, buf);
+            truncated = false;
+        }
+
+        if (len + n > config.byte_len) break;
+        memcpy(str + len, buf, n);
+        len += n;
+    }
+
+    // pad the last few bytes that could not fit a whole character so the size is exact
+    while (len < config.byte_len) str[len++] = ' ';
+    str[len] = '\0';
+
+    return (utf8_corpus) { .str = str, .byte_len = len };
+}
+
+bool parse_utf8_corpus_option(utf8_corpus_config* config, int opt, const char* arg) {
+    char* end;
+
+    switch (opt) {
+    case 'n': {
+        unsigned long long n = strtoull(arg, &end, 10);
+        if (end == arg) return false;
+        switch (*end) {
+        case 'G': n <<= 10; // fallthrough
+        case 'M': n <<= 10; // fallthrough
+        case 'K': n <<= 10; end++; break;
+        }
+        if (*end != '\0') return false;
+        config->byte_len = (size_t)n;
+        return true;
+    }
+    case 's':
+        config->seed = strtoull(arg, &end, 0);
+        return end != arg && *end == '\0';
+    case 'w':
+        for (size_t i = 0; i < 4; i++) {
+            config->weights[i] = (unsigned)strtoul(arg, &end, 10);
+            if (end == arg || *end != (i < 3 ? ',' : '\0')) return false;
+            arg = end + 1;
+        }
+        return true;
+    case 'e':
+        config->invalid_rate = strtod(arg, &end);
+        return end != arg && *end == '\0' && config->invalid_rate >= 0 && config->invalid_rate <= 1;
+    }
+
+    return false;
+}
+
+void free_utf8_corpus(utf8_corpus* corpus) {
+    if (corpus->str) {
+        free(corpus->str);
+        corpus->str = NULL;
+        corpus->byte_len = 0;
+    }
+}
@@ -0,0 +1,101 @@
+/**
+ * @file corpus.h
+ * @brief deterministic generator of synthetic UTF-8 corpora for benchmarks
+ *
+ * @code
+ * utf8_corpus_config config = default_utf8_corpus_config();
+ * config.seed = 42;
+ * config.byte_len = 8 << 20;
+ * config.weights[0] = 70; // ASCII
+ * config.weights[1] = 20; // 2-byte (Cyrillic by default)
+ * config.weights[2] = 8;  // 3-byte (CJK by default)
+ * config.weights[3] = 2;  // 4-byte (emoji by default)
+ * config.invalid_rate = 0.001;
+ *
+ * utf8_corpus corpus = make_utf8_corpus(config);
+ * // ...
+ * free_utf8_corpus(&corpus);
+ * @endcode
+ */
+
+#ifndef ZAHASH_UTF8_CORPUS_H
+#define ZAHASH_UTF8_CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Inclusive range of Unicode code points [first, last].
+ */
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} utf8_cp_range;
+
+/**
+ * @brief Describes the corpus to generate.
+ *
+ * @details Characters are drawn one at a time: first a byte length is picked according to `weights`,
+ *          then a code point is picked uniformly from the matching entry of `ranges`.
+ *          With probability `invalid_rate` the character is replaced by an invalid sequence
+ *          (stray continuation byte, truncated sequence, overlong encoding, UTF-16 surrogate or bad lead byte).
+ *
+ *          The same config (including `seed`) always produces the same bytes.
+ */
+typedef struct {
+    uint64_t seed;              ///< Seed of the pseudo random generator.
+    size_t byte_len;            ///< Size of the corpus in bytes ('\0' not counted).
+    unsigned weights[4];        ///< Relative weights of 1, 2, 3 and 4 byte characters.
+    utf8_cp_range ranges[4];    ///< Code points to draw 1, 2, 3 and 4 byte characters from.
+    double invalid_rate;        ///< Probability in [0, 1] that a character is replaced by an invalid sequence.
+} utf8_corpus_config;
+
+/**
+ * @brief A generated corpus. Never contains '\0' bytes, so it can also be used as a C-style string.
+ */
+typedef struct {
+    char* str;          ///< Pointer to the generated bytes (owned, '\0' terminated).
+    size_t byte_len;    ///< Number of generated bytes ('\0' not counted).
+} utf8_corpus;
+
+/**
+ * @brief Returns a config for a 1 MiB pure ASCII text corpus with no invalid sequences.
+ *
+ * @details The default `ranges` are printable ASCII (with spaces and newlines), Cyrillic, CJK Unified Ideographs
+ *          and emoticons, so only `weights` needs to be changed to get a realistic script mix.
+ */
+utf8_corpus_config default_utf8_corpus_config(void);
+
+/**
+ * @brief Generates a corpus described by `config`.
+ *
+ * @return The generated corpus. If memory allocation fails or the config is unusable (all weights zero,
+ *         a range that does not fit its byte length), the corpus contains a `NULL` pointer and a `byte_len` of 0.
+ */
+utf8_corpus make_utf8_corpus(utf8_corpus_config config);
+
+/**
+ * @brief Applies one command line option to `config`, for programs that let the user describe a corpus.
+ *
+ * @details Understood options (use `UTF8_CORPUS_GETOPT` in the getopt option string):
+ *          - `-n bytes`        corpus size, accepts K/M/G suffixes (e.g. `-n 64M`)
+ *          - `-s seed`         seed of the pseudo random generator
+ *          - `-w w1,w2,w3,w4`  relative weights of 1, 2, 3 and 4 byte characters
+ *          - `-e rate`         probability that a character is replaced by an invalid sequence
+ *
+ * @param config The config to update.
+ * @param opt The option character returned by getopt.
+ * @param arg The option argument.
+ * @return `true` if the option was understood and its argument was well formed; otherwise, `false`.
+ */
+bool parse_utf8_corpus_option(utf8_corpus_config* config, int opt, const char* arg);
+
+#define UTF8_CORPUS_GETOPT "n:s:w:e:"
+
+/**
+ * @brief Frees the memory allocated for a `utf8_corpus` and resets it to { .str = NULL, .byte_len = 0 }.
+ */
+void free_utf8_corpus(utf8_corpus* corpus);
+
+#endif
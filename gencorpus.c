@@ -0,0 +1,50 @@
+#include "corpus.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [-n bytes] [-s seed] [-w w1,w2,w3,w4] [-e invalid_rate] [-o file]\n"
+        "\n"
+        "  -n bytes          corpus size, accepts K/M/G suffixes (default 1M)\n"
+        "  -s seed           seed of the pseudo random generator (default 0)\n"
+        "  -w w1,w2,w3,w4    relative weights of 1/2/3/4 byte characters (default 1,0,0,0)\n"
+        "  -e invalid_rate   probability that a character is replaced by an invalid sequence (default 0)\n"
+        "  -o file           output file (default stdout)\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    utf8_corpus_config config = default_utf8_corpus_config();
+    const char* out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, UTF8_CORPUS_GETOPT "o:")) != -1) {
+        if (opt == 'o') out_path = optarg;
+        else if (!parse_utf8_corpus_option(&config, opt, optarg)) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    utf8_corpus corpus = make_utf8_corpus(config);
+    if (!corpus.str) {
+        fprintf(stderr, "%s: cannot generate corpus (bad weights or out of memory)\n", argv[0]);
+        return 1;
+    }
+
+    FILE* out = out_path ? fopen(out_path, "wb") : stdout;
+    if (!out) {
+        perror(out_path);
+        free_utf8_corpus(&corpus);
+        return 1;
+    }
+
+    int status = fwrite(corpus.str, 1, corpus.byte_len, out) == corpus.byte_len ? 0 : 1;
+    if (out != stdout) status |= fclose(out) != 0;
+    if (status) perror(out_path ? out_path : "stdout");
+
+    free_utf8_corpus(&corpus);
+    return status;
+}
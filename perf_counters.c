@@ -0,0 +1,103 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // also count the threads started afterwards, such as the workers of the parallel operations
+    attr.inherit = 1;
+    // counters are opened independently so they can be multiplexed when the PMU runs out of slots
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+perf_counters open_perf_counters(void) {
+    perf_counters counters;
+    counters.fd[PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters.fd[PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters.fd[PERF_BRANCHES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+    counters.fd[PERF_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters.fd[PERF_L1D_READ_MISSES] = open_counter(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D |
+        PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    return counters;
+}
+
+void close_perf_counters(perf_counters* counters) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters->fd[i] >= 0) close(counters->fd[i]);
+        counters->fd[i] = -1;
+    }
+}
+
+void start_perf_counters(perf_counters* counters) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters->fd[i] < 0) continue;
+        ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+perf_sample stop_perf_counters(perf_counters* counters) {
+    perf_sample sample;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        if (counters->fd[i] >= 0) ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        // { value, time_enabled, time_running }
+        uint64_t data[3];
+        sample.value[i] = 0;
+        sample.available[i] = counters->fd[i] >= 0 &&
+            read(counters->fd[i], data, sizeof(data)) == sizeof(data) &&
+            data[2] > 0;
+
+        if (sample.available[i])
+            sample.value[i] = (uint64_t)((double)data[0] * (double)data[1] / (double)data[2]);
+    }
+
+    return sample;
+}
+
+#else
+
+perf_counters open_perf_counters(void) {
+    perf_counters counters;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) counters.fd[i] = -1;
+    return counters;
+}
+
+void close_perf_counters(perf_counters* counters) {
+    (void)counters;
+}
+
+void start_perf_counters(perf_counters* counters) {
+    (void)counters;
+}
+
+perf_sample stop_perf_counters(perf_counters* counters) {
+    perf_sample sample;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        sample.value[i] = 0;
+        sample.available[i] = false;
+    }
+    (void)counters;
+    return sample;
+}
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * @file perf_counters.h
+ * @brief hardware performance counters for the benchmark harness (Linux perf_event_open)
+ *
+ * @details On other platforms, or when the kernel does not allow access to the PMU
+ *          (see /proc/sys/kernel/perf_event_paranoid), every counter reports as unavailable.
+ */
+
+#ifndef ZAHASH_UTF8_PERF_COUNTERS_H
+#define ZAHASH_UTF8_PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCHES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_READ_MISSES,
+    PERF_COUNTER_COUNT,
+} perf_counter;
+
+/**
+ * @brief Set of counters of the calling thread and of the threads it starts after opening them (user space only).
+ *
+ * @details Threads started before, like a thread pool already running, are not counted: open the counters first.
+ */
+typedef struct {
+    int fd[PERF_COUNTER_COUNT];    ///< -1 for counters that could not be opened.
+} perf_counters;
+
+/**
+ * @brief Values read from `perf_counters`, scaled for the time each counter was actually scheduled on the PMU.
+ */
+typedef struct {
+    uint64_t value[PERF_COUNTER_COUNT];
+    bool available[PERF_COUNTER_COUNT];
+} perf_sample;
+
+perf_counters open_perf_counters(void);
+void close_perf_counters(perf_counters* counters);
+
+/**
+ * @brief Resets and enables all available counters.
+ */
+void start_perf_counters(perf_counters* counters);
+
+/**
+ * @brief Disables all counters and returns what they counted since `start_perf_counters`.
+ */
+perf_sample stop_perf_counters(perf_counters* counters);
+
+#endif
@@ -1,8 +1,27 @@
+// dlsym(RTLD_NEXT, ...)
+#define _GNU_SOURCE
+
 #include "utf8.h"
+#include "utf8_io.h"
+#include "utf8_compact.h"
+#include "utf8_json.h"
+#include "utf8_position.h"
+#include "utf8_pool.h"
 
 #include <assert.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // english characters are 1 byte each
 // russian  2 bytes each
@@ -80,6 +99,109 @@ void test_validate_utf8_err() {
   assert(validity.valid_upto == 5 + 1 + 12 * 2);
 }
 
+void test_validate_utf8_n() {
+  const char* str = "Hello Здравствуйте こんにちは 🚩😁";
+  utf8_validity validity = validate_utf8_n(str, strlen(str));
+  assert(validity.valid == true);
+  assert(validity.valid_upto == strlen(str));
+
+  validity = validate_utf8_n("Hello Здравствуйте\xC0\xC0 こんにちは", 36);
+  assert(validity.valid == false);
+  assert(validity.valid_upto == 5 + 1 + 12 * 2);
+
+  // the length cuts 😁 in half
+  validity = validate_utf8_n("abcdefgh😁", 10);
+  assert(validity.valid == false);
+  assert(validity.valid_upto == 8);
+
+  // '\0' is a valid character when it is inside the length
+  validity = validate_utf8_n("a\0b", 3);
+  assert(validity.valid == true);
+  assert(validity.valid_upto == 3);
+}
+
+void test_validate_utf8_batch() {
+  const char* fields[] = {
+    "user_id",
+    "Здравствуйте",
+    "a fairly long ASCII field of more than 16 bytes",
+    "",
+    "こんにちは\xC0",
+    NULL,
+    "\xE3\x81",  // cut character
+  };
+  size_t lens[] = { 7, 24, 47, 0, 16, 0, 2 };
+  utf8_validity out[7];
+
+  validate_utf8_batch(fields, lens, 7, out);
+  for (size_t i = 0; i < 7; i++) {
+    if (fields[i] == NULL) continue;
+    utf8_validity expected = validate_utf8_n(fields[i], lens[i]);
+    assert(out[i].valid == expected.valid);
+    assert(out[i].valid_upto == expected.valid_upto);
+  }
+
+  assert(out[1].valid == true);
+  assert(out[2].valid_upto == 47);
+  assert(out[3].valid == true);
+  assert(out[4].valid == false);
+  assert(out[4].valid_upto == 15);
+  assert(out[5].valid == false);
+  assert(out[6].valid == false);
+}
+
+void test_utf8_incomplete_suffix_len() {
+  assert(utf8_incomplete_suffix_len("abc\xF0\x9F", 5) == 2);
+  assert(utf8_incomplete_suffix_len("abc\xF0\x9F\x98", 6) == 3);
+  assert(utf8_incomplete_suffix_len("abc😁", 7) == 0);
+  assert(utf8_incomplete_suffix_len("abcд", 5) == 0);
+  assert(utf8_incomplete_suffix_len("abc\xD0", 4) == 1);
+  assert(utf8_incomplete_suffix_len("abc\x80", 4) == 0); // stray continuation byte, not a cut character
+  assert(utf8_incomplete_suffix_len("", 0) == 0);
+}
+
+void test_utf8_validator_chunks() {
+  const char* str = "Hello Здравствуйте こんにちは 🚩😁";
+  size_t len = strlen(str);
+
+  // every possible split point, including ones inside characters
+  for (size_t split = 0; split <= len; split++) {
+    utf8_validator validator = make_utf8_validator();
+    feed_utf8_validator(&validator, str, split);
+    feed_utf8_validator(&validator, str + split, len - split);
+    utf8_validity validity = finish_utf8_validator(&validator);
+    assert(validity.valid == true);
+    assert(validity.valid_upto == len);
+  }
+
+  // one byte at a time
+  utf8_validator validator = make_utf8_validator();
+  for (size_t i = 0; i < len; i++) feed_utf8_validator(&validator, str + i, 1);
+  assert(finish_utf8_validator(&validator).valid_upto == len);
+}
+
+void test_utf8_validator_err() {
+  utf8_validator validator = make_utf8_validator();
+  feed_utf8_validator(&validator, "Hello \xD0", 7);
+  utf8_validity validity = feed_utf8_validator(&validator, "!", 1); // Д never completed
+  assert(validity.valid == false);
+  assert(validity.valid_upto == 6);
+
+  // stays invalid
+  validity = feed_utf8_validator(&validator, "world", 5);
+  assert(validity.valid == false);
+  assert(validity.valid_upto == 6);
+
+  // a character still incomplete at the end of the stream
+  validator = make_utf8_validator();
+  validity = feed_utf8_validator(&validator, "abc\xF0\x9F", 5);
+  assert(validity.valid == true);
+  assert(validity.valid_upto == 3);
+  validity = finish_utf8_validator(&validator);
+  assert(validity.valid == false);
+  assert(validity.valid_upto == 3);
+}
+
 void assert_overlong_encodings(utf8_char actual, utf8_char overlong) {
   assert(unicode_code_point(actual) == unicode_code_point(overlong));
 
@@ -153,6 +275,64 @@ void test_make_utf8_string_lossy_completely_invalid() {
     free_owned_utf8_string(&owned_ustr);
 }
 
+void test_utf8_lossy_iter() {
+  const char* str = "hé\xC0\xC0 😁\xF0\x9F";
+  utf8_lossy_iter iter = make_utf8_lossy_iter(str, strlen(str));
+  const char* expected[] = { "h", "é", "\uFFFD", "\uFFFD", " ", "😁", "\uFFFD", "\uFFFD" };
+  utf8_char ch;
+  size_t i = 0;
+  for (; (ch = next_utf8_lossy_char(&iter)).byte_len > 0; i++)
+    assert(ch.byte_len == strlen(expected[i]) && memcmp(ch.str, expected[i], ch.byte_len) == 0);
+  assert(i == 8 && iter.replacements == 4);
+  assert(ch.str == str + strlen(str) && next_utf8_lossy_char(&iter).byte_len == 0);
+
+  // bounded by the length, '\0' included
+  iter = make_utf8_lossy_iter("a\0\xFF", 3);
+  assert(next_utf8_lossy_char(&iter).byte_len == 1);
+  ch = next_utf8_lossy_char(&iter);
+  assert(ch.byte_len == 1 && *ch.str == '\0');
+  assert(next_utf8_lossy_char(&iter).byte_len == 3 && next_utf8_lossy_char(&iter).byte_len == 0);
+
+  iter = make_utf8_lossy_iter(NULL, 5);
+  assert(next_utf8_lossy_char(&iter).byte_len == 0);
+}
+
+// Writes fewer than `max_pieces` pieces picked at random from the first `npieces` of `pieces` to `out`, '\0' terminated,
+// and returns their byte length. An empty piece stands for a '\0' byte. `out` must have room for the longest text.
+// If `picks` is not NULL, it receives the index of every piece picked.
+size_t make_random_text(const char* const* pieces, size_t npieces, size_t max_pieces, unsigned* seed, char* out, size_t* picks) {
+  size_t len = 0;
+  for (size_t i = 0, n = rand_r(seed) % max_pieces; i < n; i++) {
+    size_t pick = rand_r(seed) % npieces;
+    size_t piece_len = *pieces[pick] ? strlen(pieces[pick]) : 1;
+    memcpy(out + len, pieces[pick], piece_len);
+    len += piece_len;
+    if (picks) picks[i] = pick;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+void test_utf8_lossy_iter_matches_lossy_string() {
+  const char* pieces[] = { "a", "д", "こ", "😁", "\x80", "\xC0", "\xE3\x81", "\xF0\x9F\x98", "\xED\xA0\x80", "\xFF" };
+  unsigned seed = 31;
+  for (int i = 0; i < 2000; i++) {
+    char str[256];
+    size_t len = make_random_text(pieces, 10, 40, &seed, str, NULL);
+
+    owned_utf8_string lossy = make_utf8_string_lossy(str);
+    utf8_lossy_iter iter = make_utf8_lossy_iter(str, len);
+    size_t offset = 0;
+    utf8_char ch;
+    while ((ch = next_utf8_lossy_char(&iter)).byte_len > 0) {
+      assert(offset + ch.byte_len <= lossy.byte_len && memcmp(lossy.str + offset, ch.str, ch.byte_len) == 0);
+      offset += ch.byte_len;
+    }
+    assert(offset == lossy.byte_len);
+    free_owned_utf8_string(&lossy);
+  }
+}
+
 void test_make_utf8_string_slice_ok() {
   utf8_string str = make_utf8_string("Hello Здравствуйте こんにちは 🚩😁");
   utf8_string slice = slice_utf8_string(str, 6, 24);
@@ -286,6 +466,27 @@ void test_nth_utf8_char_empty_string_err() {
   assert(ch.byte_len == 0);
 }
 
+void test_utf8_char_index_of() {
+  utf8_string ustr = make_utf8_string("Hello Здравствуйте こんにちは 🚩😁");
+  assert(utf8_char_index_of(ustr, 0) == 0);
+  assert(utf8_char_index_of(ustr, 8) == 7);
+  assert(utf8_char_index_of(ustr, 9) == 7);   // inside 'д'
+  assert(utf8_char_index_of(ustr, ustr.byte_len) == 27);
+  assert(utf8_char_index_of(ustr, 1000) == 27);
+  assert(utf8_char_index_of(make_utf8_string(""), 3) == 0);
+
+  // the inverse of nth_utf8_char, for every character
+  utf8_position_index index = make_utf8_position_index(ustr);
+  utf8_char ch;
+  for (size_t i = 0; (ch = nth_utf8_char(ustr, i)).str != NULL; i++) {
+    size_t byte_offset = (size_t)(ch.str - ustr.str);
+    assert(utf8_char_index_of(ustr, byte_offset) == i);
+    assert(utf8_char_index_of(ustr, byte_offset + ch.byte_len - 1) == i);
+    assert(indexed_utf8_char_index_of(&index, byte_offset + ch.byte_len - 1) == i);
+  }
+  free_utf8_position_index(&index);
+}
+
 void test_unicode_code_point() {
   utf8_string ustr = make_utf8_string("Hдこ😁");
   utf8_char_iter iter = make_utf8_char_iter(ustr);
@@ -296,6 +497,813 @@ void test_unicode_code_point() {
   assert(unicode_code_point(next_utf8_char(&iter)) == 128513); // 😁
 }
 
+void test_diagnose_utf8_valid() {
+  utf8_error_report report = diagnose_utf8("Hello Здравствуйте こんにちは 🚩😁");
+  assert(report.validity.valid == true);
+  assert(report.validity.valid_upto == 5 + 1 + 12 * 2 + 1 + 5 * 3 + 1 + 2 * 4);
+  assert(report.byte_len == report.validity.valid_upto);
+  assert(report.total_errors == 0);
+  for (int i = 0; i < UTF8_ERROR_KIND_COUNT; i++) {
+    assert(report.counts[i] == 0);
+    assert(report.first_offsets[i] == SIZE_MAX);
+  }
+}
+
+void test_diagnose_utf8_classification() {
+  // 0     bad lead (stray continuation)
+  // 1     truncated 3-byte sequence, its continuation byte at 2 is then a bad lead, 'b' at 3
+  // 4     overlong, its continuation byte at 5 is then a bad lead
+  // 6     surrogate, its continuation bytes at 7 and 8 are then bad leads
+  // 9     out of range lead
+  // 10    4-byte sequence truncated by the end of the string, bad leads at 11 and 12
+  utf8_error_report report = diagnose_utf8("\x80" "\xE3\x81" "b" "\xC1\x88" "\xED\xA0\x80" "\xF8" "\xF0\x9F\x98");
+
+  assert(report.validity.valid == false);
+  assert(report.validity.valid_upto == 0);
+  assert(report.byte_len == 13);
+
+  assert(report.counts[UTF8_ERROR_BAD_LEAD] == 7);
+  assert(report.counts[UTF8_ERROR_TRUNCATED] == 2);
+  assert(report.counts[UTF8_ERROR_OVERLONG] == 1);
+  assert(report.counts[UTF8_ERROR_SURROGATE] == 1);
+  assert(report.counts[UTF8_ERROR_OUT_OF_RANGE] == 1);
+  assert(report.total_errors == 12);
+
+  assert(report.first_offsets[UTF8_ERROR_BAD_LEAD] == 0);
+  assert(report.first_offsets[UTF8_ERROR_TRUNCATED] == 1);
+  assert(report.first_offsets[UTF8_ERROR_OVERLONG] == 4);
+  assert(report.first_offsets[UTF8_ERROR_SURROGATE] == 6);
+  assert(report.first_offsets[UTF8_ERROR_OUT_OF_RANGE] == 9);
+
+  // one error per U+FFFD of the lossy conversion
+  owned_utf8_string owned_ustr = make_utf8_string_lossy("\x80" "\xE3\x81" "b" "\xC1\x88" "\xED\xA0\x80" "\xF8" "\xF0\x9F\x98");
+  assert(owned_ustr.byte_len == 1 + report.total_errors * 3);
+  free_owned_utf8_string(&owned_ustr);
+
+  // 4 byte characters beyond U+10FFFF are valid, like for validate_utf8 and make_utf8_string_lossy
+  report = diagnose_utf8("a" "\xF4\x90\x80\x80");
+  assert(report.validity.valid && report.validity.valid_upto == 5 && report.total_errors == 0);
+  report = diagnose_utf8("\xF5\x80\x80\x80");
+  assert(report.validity.valid && report.validity.valid_upto == 4 && report.total_errors == 0);
+  report = diagnose_utf8("\xF4\x8F\xBF\xBF");
+  assert(report.validity.valid && report.total_errors == 0);
+}
+
+void test_diagnose_utf8_position_histogram() {
+  utf8_error_report report = diagnose_utf8("\xC0" "ab" "\xC0" "abcdefghijklmnopqrstuvwxyz" "\xC0");
+  assert(report.total_errors == 3);
+  assert(report.position_histogram[0] == 1); // offset 0
+  assert(report.position_histogram[1] == 0); // offsets 1-2
+  assert(report.position_histogram[2] == 1); // offsets 3-6
+  assert(report.position_histogram[4] == 1); // offsets 15-30
+}
+
+void test_scan_utf8_text_ok() {
+  const char* str = "Hello\nЗдравствуйте\nこんにちは 🚩😁\n";
+  utf8_text_stats stats = scan_utf8_text(str, strlen(str));
+  assert(stats.validity.valid == true);
+  assert(stats.validity.valid_upto == strlen(str));
+  assert(stats.char_count == 5 + 1 + 12 + 1 + 5 + 1 + 2 + 1);
+  assert(stats.line_count == 3);
+  assert(stats.is_ascii == false);
+  assert(stats.max_char_len == 4);
+}
+
+void test_scan_utf8_text_ascii() {
+  // long enough to go through the 8 byte fast path, with a tail that does not fill a word
+  const char* str = "line one\nline two\nline three\nno newline at the end";
+  utf8_text_stats stats = scan_utf8_text(str, strlen(str));
+  assert(stats.validity.valid == true);
+  assert(stats.char_count == strlen(str));
+  assert(stats.line_count == 3);
+  assert(stats.is_ascii == true);
+  assert(stats.max_char_len == 1);
+
+  stats = scan_utf8_text("", 0);
+  assert(stats.validity.valid == true);
+  assert(stats.char_count == 0);
+  assert(stats.is_ascii == true);
+  assert(stats.max_char_len == 0);
+}
+
+void test_scan_utf8_text_err() {
+  const char* str = "Hello\nЗдравствуйте\xC0\xC0 こんにちは\n";
+  utf8_text_stats stats = scan_utf8_text(str, strlen(str));
+  assert(stats.validity.valid == false);
+  assert(stats.validity.valid_upto == 5 + 1 + 12 * 2);
+  assert(stats.char_count == 5 + 1 + 12);
+  assert(stats.line_count == 1);
+  assert(stats.max_char_len == 2);
+}
+
+void test_scan_utf8_text_bounded() {
+  // a character cut by the length is truncated, even though the bytes after it would complete it
+  const char* str = "abcdefgh😁";
+  utf8_text_stats stats = scan_utf8_text(str, 10);
+  assert(stats.validity.valid == false);
+  assert(stats.validity.valid_upto == 8);
+
+  // '\0' inside the length is a character
+  stats = scan_utf8_text("a\0b", 3);
+  assert(stats.validity.valid == true);
+  assert(stats.char_count == 3);
+}
+
+void test_utf8_string_info() {
+  utf8_string_info info = make_utf8_string_info("Hello", 5);
+  assert(info.ustr.byte_len == 5 && info.char_count == 5 && info.is_ascii && info.max_char_len == 1);
+  utf8_char ch = cached_nth_utf8_char(&info, 4);
+  assert(ch.byte_len == 1 && *ch.str == 'o');
+  assert(cached_nth_utf8_char(&info, 5).str == NULL);
+
+  // uniform 3 byte characters
+  info = make_utf8_string_info("こんにちは", 15);
+  assert(info.char_count == 5 && !info.is_ascii && info.max_char_len == 3);
+  utf8_string slice = cached_slice_utf8_chars(&info, 1, 2);
+  assert(slice.byte_len == 6 && strncmp(slice.str, "んに", 6) == 0);
+  slice = cached_slice_utf8_chars(&info, 4, 100);
+  assert(slice.byte_len == 3 && strncmp(slice.str, "は", 3) == 0);
+  slice = cached_slice_utf8_chars(&info, 100, 1);
+  assert(slice.str != NULL && slice.byte_len == 0);
+
+  info = make_utf8_string_info("", 0);
+  assert(info.ustr.str != NULL && info.char_count == 0 && cached_nth_utf8_char(&info, 0).str == NULL);
+  info = make_utf8_string_info("ab\xC0", 3);
+  assert(info.ustr.str == NULL && cached_slice_utf8_chars(&info, 0, 1).str == NULL);
+}
+
+void test_utf8_string_info_mixed() {
+  utf8_string ustr = make_utf8_string("Hello Здравствуйте こんにちは 🚩😁 and some more ASCII to fill whole words");
+  utf8_string_info info = make_utf8_string_info(ustr.str, ustr.byte_len);
+  assert(info.char_count == utf8_char_count(ustr) && info.max_char_len == 4);
+
+  utf8_char ch;
+  for (size_t i = 0; (ch = nth_utf8_char(ustr, i)).str != NULL; i++) {
+    utf8_char cached = cached_nth_utf8_char(&info, i);
+    assert(cached.str == ch.str && cached.byte_len == ch.byte_len);
+  }
+
+  unsigned seed = 23;
+  for (int i = 0; i < 1000; i++) {
+    size_t start = rand_r(&seed) % (info.char_count + 2), len = rand_r(&seed) % (info.char_count + 2);
+    utf8_string slice = cached_slice_utf8_chars(&info, start, len);
+    size_t start_offset = start < info.char_count ? (size_t)(nth_utf8_char(ustr, start).str - ustr.str) : ustr.byte_len;
+    assert(slice.str == ustr.str + start_offset);
+    assert(utf8_char_index_of(slice, slice.byte_len) == (start + len < info.char_count ? len : info.char_count - (start < info.char_count ? start : info.char_count)));
+  }
+}
+
+void test_utf8_compact_string() {
+  struct { const char* str; uint8_t width; size_t length; } cases[] = {
+    { "", 1, 0 },
+    { "plain ASCII, long enough for whole words", 1, 40 },
+    { "Grüße, ÿ", 1, 8 },
+    { "Здравствуйте", 2, 12 },
+    { "aこ\xEF\xBF\xBF", 2, 3 },
+    { "a😁b", 4, 3 },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    utf8_string ustr = make_utf8_string(cases[i].str);
+    utf8_compact_string cs = make_utf8_compact_string(ustr);
+    assert(cs.data != NULL && cs.width == cases[i].width && cs.length == cases[i].length);
+
+    // the same code points as walking the string
+    utf8_char_iter iter = make_utf8_char_iter(ustr);
+    utf8_char ch;
+    for (size_t j = 0; (ch = next_utf8_char(&iter)).byte_len > 0; j++)
+      assert(compact_code_point_at(&cs, j) == unicode_code_point(ch));
+
+    owned_utf8_string back = make_utf8_string_from_compact(&cs);
+    assert(back.byte_len == ustr.byte_len && strcmp(back.str, ustr.str) == 0);
+    free_owned_utf8_string(&back);
+    free_utf8_compact_string(&cs);
+    assert(cs.data == NULL);
+  }
+
+  // '\0' bytes are characters
+  utf8_compact_string cs = make_utf8_compact_string((utf8_string) { .str = "a\0ü", .byte_len = 4 });
+  assert(cs.length == 3 && compact_code_point_at(&cs, 1) == 0 && compact_code_point_at(&cs, 2) == 0xFC);
+  free_utf8_compact_string(&cs);
+}
+
+void test_utf8_compact_string_round_trip() {
+  // the first pieces only, to get every width
+  const char* pieces[] = { "a", "é", "ÿ", "д", "こ", "😁", "abcdefgh" };
+  unsigned seed = 29;
+  for (int i = 0; i < 500; i++) {
+    char str[512];
+    size_t len = make_random_text(pieces, 1 + rand_r(&seed) % 7, 60, &seed, str, NULL);
+
+    utf8_compact_string cs = make_utf8_compact_string((utf8_string) { .str = str, .byte_len = len });
+    assert(cs.data != NULL && cs.length == utf8_char_index_of((utf8_string) { .str = str, .byte_len = len }, len));
+    owned_utf8_string back = make_utf8_string_from_compact(&cs);
+    assert(back.byte_len == len && memcmp(back.str, str, len) == 0);
+    free_owned_utf8_string(&back);
+    free_utf8_compact_string(&cs);
+  }
+}
+
+void test_escape_utf8_json() {
+  const char* str = "say \"hi\"\\ \t\n\x01 Здравствуйте こんにちは 🚩";
+  utf8_json_result r = escape_utf8_json(str, strlen(str), false);
+  assert(r.validity.valid && r.validity.valid_upto == strlen(str));
+  assert(strcmp(r.str.str, "say \\\"hi\\\"\\\\ \\t\\n\\u0001 Здравствуйте こんにちは 🚩") == 0);
+  assert(r.str.byte_len == strlen(r.str.str));
+  free_owned_utf8_string(&r.str);
+
+  // pure ASCII with \u escapes, a surrogate pair beyond U+FFFF
+  r = escape_utf8_json("aд\0こ😁", 11, true);
+  assert(strcmp(r.str.str, "a\\u0434\\u0000\\u3053\\ud83d\\ude01") == 0);
+  free_owned_utf8_string(&r.str);
+
+  // a long control character run grows the buffer
+  char controls[1000];
+  memset(controls, '\x1F', sizeof(controls));
+  r = escape_utf8_json(controls, sizeof(controls), false);
+  assert(r.str.byte_len == 6 * sizeof(controls));
+  free_owned_utf8_string(&r.str);
+
+  r = escape_utf8_json("", 0, false);
+  assert(r.validity.valid && r.str.str && r.str.byte_len == 0);
+  free_owned_utf8_string(&r.str);
+}
+
+void test_escape_utf8_json_err() {
+  // invalid UTF-8 is reported where validate_utf8 reports it
+  const char* invalid[] = { "abc\xC0\x80", "Здр\xED\xA0\x80", "long enough ascii prefix \xE3\x81", "\x80" };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    utf8_json_result r = escape_utf8_json(invalid[i], strlen(invalid[i]), i % 2);
+    assert(r.validity.valid == false);
+    assert(r.validity.valid_upto == validate_utf8(invalid[i]).valid_upto);
+    assert(r.str.str == NULL && r.str.byte_len == 0);
+  }
+
+  // characters beyond U+10FFFF, which validate_utf8 accepts, would be escaped as lone surrogates
+  const char* beyond[] = { "\xF4\x90\x80\x80", "\xF7\xBF\xBF\xBF", "more than 8 bytes д\xF5\x80\x80\x80" };
+  for (size_t i = 0; i < sizeof(beyond) / sizeof(beyond[0]); i++) {
+    for (int ascii_only = 0; ascii_only <= 1; ascii_only++) {
+      utf8_json_result r = escape_utf8_json(beyond[i], strlen(beyond[i]), ascii_only);
+      assert(r.validity.valid == false);
+      assert(r.validity.valid_upto == strlen(beyond[i]) - 4);
+      assert(r.str.str == NULL);
+    }
+  }
+  utf8_json_result r = escape_utf8_json("\xF4\x8F\xBF\xBF", 4, true);
+  assert(r.validity.valid && strcmp(r.str.str, "\\udbff\\udfff") == 0);
+  free_owned_utf8_string(&r.str);
+}
+
+void test_unescape_utf8_json() {
+  const char* json = "say \\\"hi\\\"\\\\\\/ \\b\\f\\n\\r\\t \\u0434\\u3053\\ud83d\\ude01 Здравствуйте";
+  utf8_json_result r = unescape_utf8_json(json, strlen(json));
+  assert(r.validity.valid);
+  assert(strcmp(r.str.str, "say \"hi\"\\/ \b\f\n\r\t дこ😁 Здравствуйте") == 0);
+  free_owned_utf8_string(&r.str);
+
+  // \u0000 is a character of the result
+  r = unescape_utf8_json("a\\u0000b", 8);
+  assert(r.str.byte_len == 3 && memcmp(r.str.str, "a\0b", 3) == 0);
+  free_owned_utf8_string(&r.str);
+
+  // uppercase hex digits
+  r = unescape_utf8_json("\\u00E9\\uD83D\\uDE01", 18);
+  assert(strcmp(r.str.str, "é😁") == 0);
+  free_owned_utf8_string(&r.str);
+}
+
+void test_unescape_utf8_json_err() {
+  struct { const char* json; size_t offset; } cases[] = {
+    { "ab\\x", 2 },               // unknown escape
+    { "ab\\", 2 },                // truncated escape
+    { "ab\\u12", 2 },             // truncated \u escape
+    { "ab\\u12G4", 2 },           // not hex
+    { "ab\\ud83d", 2 },           // lone high surrogate
+    { "ab\\ud83d\\u0041", 2 },    // high surrogate without low surrogate
+    { "ab\\ude01", 2 },           // lone low surrogate
+    { "ab\"cd", 2 },              // unescaped quote
+    { "ab\ncd", 2 },              // unescaped control character
+    { "Здр\xC0\x80", 6 },         // invalid UTF-8
+    { "ab\xF4\x90\x80\x80", 2 },  // beyond U+10FFFF
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    utf8_json_result r = unescape_utf8_json(cases[i].json, strlen(cases[i].json));
+    assert(r.validity.valid == false);
+    assert(r.validity.valid_upto == cases[i].offset);
+    assert(r.str.str == NULL);
+  }
+}
+
+void test_utf8_json_round_trip() {
+  const char* pieces[] = { "a", "\"", "\\", "\n", "\x01", "/", "д", "こ", "😁", "\x7F" };
+  unsigned seed = 11;
+  for (int i = 0; i < 2000; i++) {
+    char str[256];
+    size_t len = make_random_text(pieces, 10, 40, &seed, str, NULL);
+
+    for (int ascii_only = 0; ascii_only <= 1; ascii_only++) {
+      utf8_json_result escaped = escape_utf8_json(str, len, ascii_only);
+      assert(escaped.validity.valid);
+      utf8_json_result unescaped = unescape_utf8_json(escaped.str.str, escaped.str.byte_len);
+      assert(unescaped.validity.valid);
+      assert(unescaped.str.byte_len == len && memcmp(unescaped.str.str, str, len) == 0);
+      free_owned_utf8_string(&escaped.str);
+      free_owned_utf8_string(&unescaped.str);
+    }
+  }
+}
+
+void test_utf8_position() {
+  // 'a' 1 byte, 'д' 2 bytes, 'こ' 3 bytes, '😁' 4 bytes and 2 UTF-16 code units
+  utf8_string ustr = { .str = "aдこ😁b", .byte_len = 11 };
+  utf8_position pos = utf8_position_at_byte(ustr, 6);
+  assert(pos.byte_offset == 6 && pos.char_index == 3 && pos.utf16_offset == 3);
+  pos = utf8_position_at_byte(ustr, 10);
+  assert(pos.byte_offset == 10 && pos.char_index == 4 && pos.utf16_offset == 5);
+
+  // inside a character: rounded down
+  pos = utf8_position_at_byte(ustr, 8);
+  assert(pos.byte_offset == 6 && pos.char_index == 3);
+  pos = utf8_position_at_char(ustr, 2);
+  assert(pos.byte_offset == 3 && pos.utf16_offset == 2);
+
+  // between the halves of the surrogate pair: rounded down
+  pos = utf8_position_at_utf16(ustr, 4);
+  assert(pos.byte_offset == 6 && pos.char_index == 3 && pos.utf16_offset == 3);
+  pos = utf8_position_at_utf16(ustr, 5);
+  assert(pos.byte_offset == 10 && pos.char_index == 4);
+
+  // beyond the end: clamped
+  pos = utf8_position_at_char(ustr, 100);
+  assert(pos.byte_offset == 11 && pos.char_index == 5 && pos.utf16_offset == 6);
+  pos = utf8_position_at_utf16((utf8_string) { .str = "", .byte_len = 0 }, 3);
+  assert(pos.byte_offset == 0 && pos.char_index == 0 && pos.utf16_offset == 0);
+}
+
+void test_utf8_position_indexed() {
+  const char* pieces[] = { "a", "\n", "д", "こ", "😁", "" };
+  size_t piece_lens[] = { 1, 1, 2, 3, 4, 1 };
+  size_t piece_units[] = { 1, 1, 1, 1, 2, 1 };
+  unsigned seed = 17;
+  for (int i = 0; i < 20; i++) {
+    // long enough for several checkpoints
+    static char str[20001];
+    static size_t picks[5000];
+    size_t len = make_random_text(pieces, 6, 5000, &seed, str, picks);
+
+    // the reference position of every byte offset, from the lengths of the pieces picked
+    static utf8_position expected[20001];
+    size_t offset = 0, chars = 0, units = 0;
+    for (size_t k = 0; offset < len; k++) {
+      for (size_t j = 0; j < piece_lens[picks[k]]; j++)
+        expected[offset + j] = (utf8_position) { offset, chars, units };
+      offset += piece_lens[picks[k]];
+      chars++;
+      units += piece_units[picks[k]];
+    }
+    assert(offset == len);
+    expected[len] = (utf8_position) { len, chars, units };
+
+    utf8_string ustr = { .str = str, .byte_len = len };
+    utf8_position_index index = make_utf8_position_index(ustr);
+    assert(index.checkpoints != NULL);
+    for (size_t offset = 0; offset <= len; offset++) {
+      utf8_position e = expected[offset];
+      utf8_position pos = utf8_position_at_byte(ustr, offset);
+      assert(memcmp(&pos, &e, sizeof(pos)) == 0);
+      pos = indexed_utf8_position_at_byte(&index, offset);
+      assert(memcmp(&pos, &e, sizeof(pos)) == 0);
+      if (e.byte_offset != offset) continue;
+
+      pos = utf8_position_at_char(ustr, e.char_index);
+      assert(memcmp(&pos, &e, sizeof(pos)) == 0);
+      pos = indexed_utf8_position_at_char(&index, e.char_index);
+      assert(memcmp(&pos, &e, sizeof(pos)) == 0);
+      pos = utf8_position_at_utf16(ustr, e.utf16_offset);
+      assert(memcmp(&pos, &e, sizeof(pos)) == 0);
+      pos = indexed_utf8_position_at_utf16(&index, e.utf16_offset);
+      assert(memcmp(&pos, &e, sizeof(pos)) == 0);
+    }
+    free_utf8_position_index(&index);
+  }
+}
+
+void test_utf8_position_lines() {
+  utf8_string ustr = { .str = "ab\n😁c\n\nこ", .byte_len = 13 };
+  utf8_position_index index = make_utf8_position_index(ustr);
+  assert(index.line_count == 4);
+  assert(utf8_line_start(&index, 1).byte_offset == 3);
+  assert(utf8_line_start(&index, 3).byte_offset == 10 && utf8_line_start(&index, 3).utf16_offset == 8);
+  assert(utf8_line_start(&index, 9).byte_offset == 10);
+
+  assert(utf8_line_of(&index, 0) == 0);
+  assert(utf8_line_of(&index, 2) == 0);
+  assert(utf8_line_of(&index, 3) == 1);
+  assert(utf8_line_of(&index, 9) == 2);
+  assert(utf8_line_of(&index, 100) == 3);
+
+  // LSP { line: 1, character: 2 } is after the surrogate pair
+  utf8_position pos = utf8_position_at_line_utf16(&index, 1, 2);
+  assert(pos.byte_offset == 7 && pos.char_index == 4 && pos.utf16_offset == 5);
+  // clamped to the end of the line, before its '\n'
+  pos = utf8_position_at_line_utf16(&index, 1, 10);
+  assert(pos.byte_offset == 8 && pos.char_index == 5 && pos.utf16_offset == 6);
+  pos = utf8_position_at_line_utf16(&index, 2, 1);
+  assert(pos.byte_offset == 9);
+  // and to the end of the text on the last line
+  pos = utf8_position_at_line_utf16(&index, 5, 10);
+  assert(pos.byte_offset == 13 && pos.char_index == 8 && pos.utf16_offset == 9);
+  free_utf8_position_index(&index);
+
+  index = make_utf8_position_index((utf8_string) { .str = "", .byte_len = 0 });
+  assert(index.line_count == 1 && utf8_position_at_line_utf16(&index, 0, 5).byte_offset == 0);
+  free_utf8_position_index(&index);
+}
+
+// 3 MiB of 3-byte characters, so 1 MiB blocks cut characters in half
+char* make_cjk_text(size_t* len) {
+  *len = 3 << 20;
+  char* text = malloc(*len + 1);
+  for (size_t i = 0; i < *len; i += 3) memcpy(text + i, "こ", 3);
+  text[*len] = '\0';
+  return text;
+}
+
+void write_temp_file(char* path, const char* data, size_t len) {
+  strcpy(path, "/tmp/utf8_test_XXXXXX");
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(write(fd, data, len) == (ssize_t)len);
+  close(fd);
+}
+
+void test_validate_utf8_file() {
+  size_t len;
+  char* text = make_cjk_text(&len);
+  char path[32];
+
+  write_temp_file(path, text, len);
+  utf8_file_validity result = validate_utf8_file(path);
+  assert(result.error == 0);
+  assert(result.validity.valid == true);
+  assert(result.validity.valid_upto == len);
+  assert(result.byte_len == len);
+
+  utf8_file_stats stats = scan_utf8_file(path);
+  assert(stats.error == 0);
+  assert(stats.stats.validity.valid == true);
+  assert(stats.stats.char_count == len / 3);
+  assert(stats.stats.max_char_len == 3);
+  unlink(path);
+
+  text[len - 1] = 'x'; // truncates the last character
+  write_temp_file(path, text, len);
+  result = validate_utf8_file(path);
+  assert(result.error == 0);
+  assert(result.validity.valid == false);
+  assert(result.validity.valid_upto == len - 3);
+  unlink(path);
+
+  free(text);
+
+  result = validate_utf8_file("/nonexistent/file");
+  assert(result.error == ENOENT);
+  assert(result.validity.valid == false);
+}
+
+void test_validate_utf8_fd_pipe() {
+  size_t len;
+  char* text = make_cjk_text(&len);
+
+  int fds[2];
+  assert(pipe(fds) == 0);
+
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    close(fds[0]);
+    write(fds[1], text, len);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  utf8_file_stats result = scan_utf8_fd(fds[0]);
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+
+  assert(result.error == 0);
+  assert(result.stats.validity.valid == true);
+  assert(result.stats.validity.valid_upto == len);
+  assert(result.stats.char_count == len / 3);
+
+  free(text);
+}
+
+void test_sanitize_utf8_fd() {
+  size_t len;
+  char* text = make_cjk_text(&len);
+  text[4] = '\xFF';              // breaks the 2nd character
+  text[(1 << 20) + 2] = '\xC0';  // breaks a character right behind the first block boundary
+  text[len - 1] = 'x';           // truncates the last character
+
+  char in_path[32], out_path[32];
+  write_temp_file(in_path, text, len);
+  write_temp_file(out_path, "", 0);
+
+  int in_fd = open(in_path, O_RDONLY);
+  int out_fd = open(out_path, O_WRONLY | O_TRUNC);
+  utf8_sanitize_result result = sanitize_utf8_fd(in_fd, out_fd);
+  close(in_fd);
+  close(out_fd);
+
+  owned_utf8_string expected = make_utf8_string_lossy(text);
+  assert(result.error == 0);
+  assert(result.bytes_read == len);
+  assert(result.bytes_written == expected.byte_len);
+  assert(result.replacements == 3 + 3 + 2);
+
+  char* written = malloc(expected.byte_len + 1);
+  int fd = open(out_path, O_RDONLY);
+  assert(read(fd, written, expected.byte_len + 1) == (ssize_t)expected.byte_len);
+  assert(memcmp(written, expected.str, expected.byte_len) == 0);
+  close(fd);
+
+  unlink(in_path);
+  unlink(out_path);
+  free(written);
+  free_owned_utf8_string(&expected);
+  free(text);
+}
+
+void test_validate_utf8_files() {
+  size_t len;
+  char* text = make_cjk_text(&len);
+  char paths[5][32];
+
+  write_temp_file(paths[0], text, len);
+  write_temp_file(paths[1], "", 0);
+  text[len / 2] = 'x'; // replaces a lead byte, leaving its continuation bytes behind
+  write_temp_file(paths[2], text, len);
+  write_temp_file(paths[3], "Hello Здравствуйте", strlen("Hello Здравствуйте"));
+  strcpy(paths[4], "/nonexistent/file");
+
+  const char* const path_ptrs[] = { paths[0], paths[1], paths[2], paths[3], paths[4] };
+  utf8_file_validity results[5];
+
+  // small blocks and fewer slots than files, so every slot is reused and files take many reads
+  utf8_bulk_config config = { .queue_depth = 2, .block_size = 4096, .threads = 3 };
+  assert(validate_utf8_files(path_ptrs, 5, config, results) == 0);
+
+  assert(results[0].error == 0);
+  assert(results[0].validity.valid == true);
+  assert(results[0].byte_len == len);
+  assert(results[1].error == 0);
+  assert(results[1].validity.valid == true);
+  assert(results[1].byte_len == 0);
+  assert(results[2].error == 0);
+  assert(results[2].validity.valid == false);
+  assert(results[2].validity.valid_upto == len / 2 + 1);
+  assert(results[3].validity.valid == true);
+  assert(results[3].validity.valid_upto == strlen("Hello Здравствуйте"));
+  assert(results[4].error == ENOENT);
+  assert(results[4].validity.valid == false);
+
+  for (int i = 0; i < 4; i++) unlink(paths[i]);
+  free(text);
+}
+
+#ifdef __NR_io_uring_enter
+// Number of io_uring_enter calls that succeed before one fails with EBUSY, negative for none. utf8_io.c drives
+// io_uring through syscall(2), and this definition takes the place of the libc one in the test programs.
+atomic_int uring_enters_before_failure = -1;
+
+long syscall(long number, ...) {
+  va_list args;
+  va_start(args, number);
+  long arg[6];
+  for (int i = 0; i < 6; i++) arg[i] = va_arg(args, long);
+  va_end(args);
+
+  if (number == __NR_io_uring_enter && atomic_fetch_sub(&uring_enters_before_failure, 1) == 0) {
+    errno = EBUSY;
+    return -1;
+  }
+  long (*libc_syscall)(long, ...) = (long (*)(long, ...))dlsym(RTLD_NEXT, "syscall");
+  return libc_syscall(number, arg[0], arg[1], arg[2], arg[3], arg[4], arg[5]);
+}
+
+void test_validate_utf8_files_failed_submission() {
+  char paths[3][32];
+  write_temp_file(paths[0], "first", 5);
+  write_temp_file(paths[1], "Здравствуйте", 24);
+  write_temp_file(paths[2], "こんにちは", 15);
+
+  const char* const path_ptrs[] = { paths[0], paths[1], paths[2] };
+  utf8_file_validity results[3];
+
+  // the first reads of the first two files are submitted in order, and the second one fails. The third file takes
+  // its slot, and its reads are not mixed up with the one that failed (it would be read twice)
+  utf8_bulk_config config = { .queue_depth = 2, .block_size = 4096, .threads = 1 };
+  uring_enters_before_failure = 1;
+  assert(validate_utf8_files(path_ptrs, 3, config, results) == 0);
+
+  // where io_uring is unavailable the files are read without it, and nothing fails
+  bool failed = uring_enters_before_failure < 0;
+  uring_enters_before_failure = -1;
+  assert(results[0].error == 0 && results[0].validity.valid && results[0].byte_len == 5);
+  assert(results[1].error == (failed ? EBUSY : 0));
+  assert(results[1].byte_len == (failed ? 0 : 24));
+  assert(results[2].error == 0 && results[2].validity.valid && results[2].byte_len == 15);
+
+  for (int i = 0; i < 3; i++) unlink(paths[i]);
+}
+#endif
+
+typedef struct {
+  const char* const* paths;
+  utf8_file_validity* results;
+} bulk_files_job;
+
+void* validate_files_on_thread(void* arg) {
+  bulk_files_job* job = arg;
+  utf8_bulk_config config = { .queue_depth = 1, .block_size = 4096, .threads = 8 };
+  assert(validate_utf8_files(job->paths, 2, config, job->results) == 0);
+  return NULL;
+}
+
+void test_validate_utf8_files_keeps_pool_free() {
+  // a worker blocks opening a FIFO until it has a writer, the others wait for completions
+  char paths[2][64];
+  write_temp_file(paths[0], "first", 5);
+  strcpy(paths[1], paths[0]);
+  strcat(paths[1], ".fifo");
+  assert(mkfifo(paths[1], 0600) == 0);
+
+  const char* const path_ptrs[] = { paths[0], paths[1] };
+  utf8_file_validity results[2];
+  bulk_files_job job = { .paths = path_ptrs, .results = results };
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, validate_files_on_thread, &job) == 0);
+
+  // meanwhile the shared pool is not held by the blocked workers
+  size_t len;
+  char* text = make_cjk_text(&len);
+  assert(utf8_char_count_parallel(NULL, (utf8_string) { .str = text, .byte_len = len }) == len / 3);
+  assert(validate_utf8_parallel(NULL, text, len).valid);
+
+  int fd = open(paths[1], O_WRONLY);
+  assert(fd >= 0);
+  assert(write(fd, "Здр", 6) == 6);
+  close(fd);
+  pthread_join(thread, NULL);
+
+  assert(results[0].validity.valid && results[0].byte_len == 5);
+  assert(results[1].validity.valid && results[1].byte_len == 6);
+
+  unlink(paths[0]);
+  unlink(paths[1]);
+  free(text);
+}
+
+typedef struct {
+  utf8_pool* pool;
+  size_t value;
+  size_t sum;
+} sum_job;
+
+void add_value(void* arg) {
+  sum_job* job = arg;
+  job->sum = job->value;
+}
+
+// sums 1..value, running a nested task per half
+void sum_nested(void* arg) {
+  sum_job* job = arg;
+  if (job->value <= 1) {
+    job->sum = job->value;
+    return;
+  }
+
+  sum_job halves[2] = {
+    { .pool = job->pool, .value = job->value / 2 },
+    { .pool = job->pool, .value = job->value - job->value / 2 },
+  };
+  run_utf8_pool_tasks(job->pool, sum_nested, halves, sizeof(sum_job), 2);
+  // 1..a + 1..b, shifted so the second half covers a+1..value
+  job->sum = halves[0].sum + halves[1].sum + halves[1].value * halves[0].value;
+}
+
+void test_utf8_pool_tasks() {
+  utf8_pool* pool = make_utf8_pool((utf8_pool_config) { .threads = 3 });
+  assert(pool != NULL);
+  assert(utf8_pool_threads(pool) == 3);
+
+  sum_job jobs[1000];
+  for (size_t i = 0; i < 1000; i++) jobs[i] = (sum_job) { .pool = pool, .value = i };
+  run_utf8_pool_tasks(pool, add_value, jobs, sizeof(sum_job), 1000);
+  for (size_t i = 0; i < 1000; i++) assert(jobs[i].sum == i);
+
+  sum_job nested = { .pool = pool, .value = 1000 };
+  sum_nested(&nested);
+  assert(nested.sum == 1000 * 1001 / 2);
+
+  free_utf8_pool(pool);
+}
+
+void test_utf8_pool_nodes() {
+  utf8_pool* pool = make_utf8_pool((utf8_pool_config) { .threads = 2 });
+  assert(utf8_pool_nodes(pool) >= 1);
+
+  // hints for any node, node 0 and a node that may not exist
+  sum_job jobs[64];
+  int nodes[64];
+  for (size_t i = 0; i < 64; i++) {
+    jobs[i] = (sum_job) { .pool = pool, .value = i };
+    nodes[i] = (int)(i % 3) - 1;
+  }
+  run_utf8_pool_tasks_on_nodes(pool, add_value, jobs, sizeof(sum_job), 64, nodes);
+  for (size_t i = 0; i < 64; i++) assert(jobs[i].sum == i);
+  free_utf8_pool(pool);
+
+  pool = make_utf8_pool((utf8_pool_config) { .threads = 2, .ignore_numa = true });
+  assert(utf8_pool_nodes(pool) == 1);
+  free_utf8_pool(pool);
+}
+
+void test_validate_utf8_parallel() {
+  utf8_pool* pool = make_utf8_pool((utf8_pool_config) { .threads = 3 });
+  size_t len;
+  char* text = make_cjk_text(&len);
+
+  utf8_validity validity = validate_utf8_parallel(pool, text, len);
+  assert(validity.valid == true);
+  assert(validity.valid_upto == len);
+  assert(utf8_char_count_parallel(pool, (utf8_string) { .str = text, .byte_len = len }) == len / 3);
+
+  // errors near the end and close to chunk boundaries, the first one wins
+  text[len - 5] = '\xFF';
+  text[(1 << 20) + 1] = '\xC0';
+  validity = validate_utf8_parallel(pool, text, len);
+  utf8_validity expected = validate_utf8_n(text, len);
+  assert(validity.valid == false);
+  assert(validity.valid_upto == expected.valid_upto);
+
+  // counting stops at '\0' like utf8_char_count
+  utf8_string ustr = { .str = text, .byte_len = len };
+  text[len / 2] = '\0';
+  assert(utf8_char_count_parallel(pool, ustr) == utf8_char_count(ustr));
+
+  // a slice too short to be split is counted up to its byte length too, not up to the '\0' of the buffer
+  memset(text, 'a', len / 2);
+  assert(utf8_char_count_parallel(pool, (utf8_string) { .str = text, .byte_len = 100 }) == 100);
+  assert(utf8_char_count_parallel(pool, (utf8_string) { .str = text + 1, .byte_len = 0 }) == 0);
+  assert(utf8_char_count_parallel(pool, (utf8_string) { .str = text, .byte_len = 1 << 20 }) == 1 << 20);
+
+  free(text);
+  free_utf8_pool(pool);
+}
+
+#ifdef UTF8_STATS
+void* validate_on_thread(void* arg) {
+  validate_utf8((const char*)arg);
+  return NULL;
+}
+#endif
+
+void test_utf8_stats() {
+  utf8_stats before = utf8_stats_snapshot();
+
+  validate_utf8("Hello Здравствуйте");                  // 6 + 24 bytes
+  validate_utf8("Hello\xC0\xC0");                       // invalid after 5 bytes
+  owned_utf8_string owned_ustr = make_utf8_string_lossy("a\xC0" "b\xC0"); // 4 bytes, 2 replacements
+  free_owned_utf8_string(&owned_ustr);
+  nth_utf8_char(make_utf8_string("Hдこ😁"), 2);          // validates 10 bytes, walks 3 chars (6 bytes)
+
+  utf8_stats after = utf8_stats_snapshot();
+
+#ifdef UTF8_STATS
+  assert(after.calls - before.calls == 5);
+  assert(after.bytes_processed - before.bytes_processed == 30 + 6 + 4 + 10 + 6);
+  assert(after.invalid_sequences - before.invalid_sequences == 1 + 2);
+  assert(after.replacements - before.replacements == 2);
+  assert(after.nth_char_calls - before.nth_char_calls == 1);
+  assert(after.nth_char_steps - before.nth_char_steps == 3);
+
+  // counts of threads that have exited are kept
+  pthread_t thread;
+  pthread_create(&thread, NULL, validate_on_thread, "Hello");
+  pthread_join(thread, NULL);
+
+  utf8_stats joined = utf8_stats_snapshot();
+  assert(joined.calls - after.calls == 1);
+  assert(joined.bytes_processed - after.bytes_processed == 5);
+#else
+  // counting is compiled out
+  assert(before.calls == 0 && after.calls == 0);
+  assert(after.bytes_processed == 0);
+  assert(after.replacements == 0);
+#endif
+}
+
 int ntests = 0;
 #define TEST(test_fn) test_fn(); ntests++; printf("%s\n", #test_fn);
 
@@ -304,12 +1312,19 @@ int main() {
   TEST(test_validate_utf8_boundary_ok);
   TEST(test_surrogate_rejection);
   TEST(test_validate_utf8_err);
+  TEST(test_validate_utf8_n);
+  TEST(test_validate_utf8_batch);
+  TEST(test_utf8_incomplete_suffix_len);
+  TEST(test_utf8_validator_chunks);
+  TEST(test_utf8_validator_err);
   TEST(test_validate_utf8_overlong_encoding_err);
   TEST(test_make_utf8_string_ok);
   TEST(test_make_utf8_string_err);
   TEST(test_make_utf8_string_lossy_ok);
   TEST(test_make_utf8_string_lossy_invalid_sequence);
   TEST(test_make_utf8_string_lossy_completely_invalid);
+  TEST(test_utf8_lossy_iter);
+  TEST(test_utf8_lossy_iter_matches_lossy_string);
   TEST(test_make_utf8_string_slice_ok);
   TEST(test_make_utf8_string_slice_start_out_of_bounds_ok);
   TEST(test_make_utf8_string_slice_end_out_of_bounds_ok);
@@ -324,7 +1339,39 @@ int main() {
   TEST(test_nth_utf8_char_last_index_ok);
   TEST(test_nth_utf8_char_invalid_index_err);
   TEST(test_nth_utf8_char_empty_string_err);
+  TEST(test_utf8_char_index_of);
   TEST(test_unicode_code_point);
+  TEST(test_diagnose_utf8_valid);
+  TEST(test_diagnose_utf8_classification);
+  TEST(test_diagnose_utf8_position_histogram);
+  TEST(test_scan_utf8_text_ok);
+  TEST(test_scan_utf8_text_ascii);
+  TEST(test_scan_utf8_text_err);
+  TEST(test_scan_utf8_text_bounded);
+  TEST(test_utf8_string_info);
+  TEST(test_utf8_string_info_mixed);
+  TEST(test_utf8_compact_string);
+  TEST(test_utf8_compact_string_round_trip);
+  TEST(test_escape_utf8_json);
+  TEST(test_escape_utf8_json_err);
+  TEST(test_unescape_utf8_json);
+  TEST(test_unescape_utf8_json_err);
+  TEST(test_utf8_json_round_trip);
+  TEST(test_utf8_position);
+  TEST(test_utf8_position_indexed);
+  TEST(test_utf8_position_lines);
+  TEST(test_validate_utf8_file);
+  TEST(test_validate_utf8_fd_pipe);
+  TEST(test_sanitize_utf8_fd);
+  TEST(test_validate_utf8_files);
+#ifdef __NR_io_uring_enter
+  TEST(test_validate_utf8_files_failed_submission);
+#endif
+  TEST(test_validate_utf8_files_keeps_pool_free);
+  TEST(test_utf8_pool_tasks);
+  TEST(test_utf8_pool_nodes);
+  TEST(test_validate_utf8_parallel);
+  TEST(test_utf8_stats);
 
   printf("\n** %d tests passed **\n", ntests);
   return 0;
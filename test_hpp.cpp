@@ -0,0 +1,419 @@
+#include "utf8.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <functional>
+#include <numeric>
+#include <iterator>
+#include <string>
+#include <ranges>
+#include <type_traits>
+#include <vector>
+
+// english characters are 1 byte each
+// russian  2 bytes each
+// japanese 3 bytes each
+// 🚩 and 😁 is 4 bytes each
+
+static_assert(std::bidirectional_iterator<utf8::char_iterator>);
+static_assert(std::ranges::bidirectional_range<utf8::string_view>);
+static_assert(std::ranges::view<utf8::string_view>);
+static_assert(std::ranges::borrowed_range<utf8::string_view>);
+static_assert(std::ranges::bidirectional_range<const utf8::string>);
+static_assert(std::ranges::bidirectional_range<utf8::chars<utf8::trusted>>);
+static_assert(std::ranges::forward_range<utf8::chars<utf8::checked>>);
+static_assert(std::ranges::forward_range<utf8::chars<utf8::lossy>>);
+static_assert(std::ranges::view<utf8::chars<utf8::lossy>>);
+static_assert(std::random_access_iterator<utf8::chunks::iterator>);
+static_assert(std::ranges::random_access_range<utf8::chunks>);
+static_assert(std::ranges::sized_range<utf8::chunks>);
+static_assert(std::ranges::borrowed_range<utf8::chunks>);
+static_assert(std::ranges::input_range<utf8::generator<utf8::string_view>>);
+static_assert(!std::is_copy_constructible_v<utf8::generator<uint32_t>>);
+static_assert(std::is_same_v<utf8::char_iterator, utf8::basic_char_iterator<utf8::trusted>>);
+static_assert(!std::is_copy_constructible_v<utf8::string>);
+static_assert(!std::is_copy_assignable_v<utf8::string>);
+static_assert(std::is_nothrow_move_constructible_v<utf8::string>);
+static_assert(utf8::string_view::from_validated("Здравствуйте").char_count() == 12);
+
+using namespace utf8::literals;
+
+static_assert("Hello Здравствуйте こんにちは 🚩😁"_u8s.byte_len() == 5 + 1 + 12 * 2 + 1 + 5 * 3 + 1 + 2 * 4);
+static_assert("Hello Здравствуйте こんにちは 🚩😁"_u8s.char_count() == 5 + 1 + 12 + 1 + 5 + 1 + 2);
+static_assert(""_u8s.empty() && ""_u8s.char_count() == 0);
+static_assert("a\0b"_u8s.char_count() == 3);
+static_assert(std::ranges::bidirectional_range<utf8::literal>);
+
+static_assert(utf8::validate("\xF0\x90\x80\x80").valid);
+static_assert(utf8::validate("hello\xC0\xC0").valid_upto == 5);
+static_assert(!utf8::validate("\xED\xA0\x80").valid);              // surrogate
+static_assert(!utf8::validate("\xE0\x80\xAF").valid);              // overlong
+static_assert(!utf8::validate(std::string_view("\xE3\x81", 2)).valid);
+static_assert(utf8::string_view::from_bytes("こんにちは")->char_count() == 5);
+
+void test_string_view_from_bytes() {
+  auto view = utf8::string_view::from_bytes("Hello Здравствуйте こんにちは 🚩😁");
+  assert(view);
+  assert(view->byte_len() == 5 + 1 + 12 * 2 + 1 + 5 * 3 + 1 + 2 * 4);
+  assert(view->char_count() == 5 + 1 + 12 + 1 + 5 + 1 + 2);
+
+  assert(!utf8::string_view::from_bytes("hello\xC0\xC0"));
+  assert(!utf8::string_view::from_bytes(std::string_view("\xE3\x81", 2)));
+
+  // not '\0' terminated, and '\0' is a character like any other
+  auto bytes = std::string_view("ab\0cd", 5);
+  view = utf8::string_view::from_bytes(bytes.substr(1, 3));
+  assert(view && view->byte_len() == 3 && view->char_count() == 3);
+}
+
+void test_string_view_c_interop() {
+  utf8_string ustr = make_utf8_string("こんにちは");
+  utf8::string_view view = ustr;
+  assert(view.data() == ustr.str && view.byte_len() == ustr.byte_len);
+
+  utf8_string back = view;
+  assert(back.str == ustr.str && back.byte_len == ustr.byte_len);
+  assert(utf8_char_count(back) == 5);
+
+  // the invalid result of make_utf8_string is an empty view
+  utf8::string_view invalid = make_utf8_string("\xC0\xC0");
+  assert(invalid.empty() && invalid.begin() == invalid.end());
+}
+
+void test_string_view_iteration() {
+  auto view = *utf8::string_view::from_bytes("aЗこ🚩");
+  std::vector<uint32_t> code_points;
+  for (utf8::character ch : view) code_points.push_back(ch.code_point());
+  assert((code_points == std::vector<uint32_t> { 0x61, 0x417, 0x3053, 0x1F6A9 }));
+
+  // backwards over the same boundaries
+  std::vector<size_t> lens;
+  for (utf8::character ch : view | std::views::reverse) lens.push_back(ch.byte_len());
+  assert((lens == std::vector<size_t> { 4, 3, 2, 1 }));
+
+  auto it = view.end();
+  --it;
+  assert((*it).bytes() == "🚩");
+  assert(std::ranges::distance(view) == 4);
+
+  // the same characters as next_utf8_char
+  utf8_char_iter iter = make_utf8_char_iter(view);
+  for (utf8::character ch : view) {
+    utf8_char c = next_utf8_char(&iter);
+    assert(ch.data() == c.str && ch.byte_len() == c.byte_len);
+  }
+  assert(next_utf8_char(&iter).byte_len == 0);
+
+  auto japanese = view | std::views::filter([](utf8::character ch) { return ch.byte_len() == 3; });
+  assert(std::ranges::distance(japanese) == 1);
+}
+
+void test_string_view_slice() {
+  auto view = *utf8::string_view::from_bytes("Hello Здравствуйте");
+
+  auto slice = view.slice(6, 4);
+  assert(slice && slice->bytes() == "Зд");
+  assert(!view.slice(6, 3));
+  assert(!view.slice(7, 2));
+
+  // clamped to the view like slice_utf8_string
+  slice = view.slice(10, 100);
+  assert(slice && slice->byte_len() == view.byte_len() - 10);
+  slice = view.slice(100, 1);
+  assert(slice && slice->empty());
+}
+
+void test_string_lossy() {
+  utf8::string s = utf8::string::lossy("hello\xC0\xC0 world!");
+  assert(s.view().bytes() == "hello\xEF\xBF\xBD\xEF\xBF\xBD world!");
+  assert(s.c_str()[s.byte_len()] == '\0');
+  assert(utf8::string_view::from_bytes(s.view().bytes()));
+
+  utf8::string empty;
+  assert(empty.empty() && *empty.c_str() == '\0' && empty.begin() == empty.end());
+}
+
+void test_string_move_only() {
+  utf8::string a = utf8::string::lossy("Здравствуйте");
+  const char* buffer = a.data();
+
+  utf8::string b = std::move(a);
+  assert(b.data() == buffer && a.empty());
+
+  a = std::move(b);
+  assert(a.data() == buffer && b.empty());
+
+  utf8::string c = a.clone();
+  assert(c.data() != a.data() && c.view() == a.view());
+
+  utf8::string_view view = c;
+  assert(view.data() == c.data() && view.char_count() == 12);
+
+  owned_utf8_string owned = c.release();
+  assert(c.empty() && owned.str == view.data());
+  utf8::string adopted(owned);
+  assert(adopted.data() == owned.str);
+
+  utf8::string copy = utf8::string::copy_of(view.slice(0, 4).value());
+  assert(copy.view().bytes() == "Зд");
+}
+
+void test_literal() {
+  constexpr utf8::literal greeting = "こんにちは"_u8s;
+  utf8_string ustr = greeting;
+  assert(ustr.byte_len == 15 && utf8_char_count(ustr) == greeting.char_count());
+  assert(greeting.c_str()[greeting.byte_len()] == '\0');
+
+  utf8::string_view view = greeting;
+  assert(view == *utf8::string_view::from_bytes("こんにちは"));
+  assert(std::ranges::distance(greeting) == 5);
+}
+
+void test_validate_matches_c() {
+  const char* cases[] = {
+    "\x7F", "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xEF\xBF\xBF", "\xF0\x90\x80\x80", "\xF7\xBF\xBF\xBF",
+    "\xC0\x80", "\xC1\xBF", "\xE0\x9F\xBF", "\xF0\x8F\xBF\xBF", "\xED\x9F\xBF", "\xED\xA0\x80", "\xED\xBF\xBF",
+    "\x80", "\xBF", "\xF8\x88\x80\x80\x80", "\xFF", "\xC2", "\xE3\x81", "\xF0\x9F\x98", "ab\xC3\x28" "cd",
+  };
+  for (const char* str : cases) {
+    utf8_validity expected = validate_utf8_n(str, strlen(str));
+    utf8_validity actual = utf8::detail::validate_bytes(str);
+    assert(actual.valid == expected.valid && actual.valid_upto == expected.valid_upto);
+  }
+
+  // random bytes biased towards valid multi-byte sequences
+  const unsigned char alphabet[] = { 'a', 0x80, 0x9F, 0xA0, 0xBF, 0xC2, 0xDF, 0xE0, 0xED, 0xEF, 0xF0, 0xF4, 0xF7, 0xF8 };
+  srand(42);
+  for (int i = 0; i < 100000; i++) {
+    char buffer[8];
+    size_t len = rand() % sizeof(buffer);
+    for (size_t j = 0; j < len; j++) buffer[j] = alphabet[rand() % sizeof(alphabet)];
+
+    utf8_validity expected = validate_utf8_n(buffer, len);
+    utf8_validity actual = utf8::detail::validate_bytes({ buffer, len });
+    assert(actual.valid == expected.valid && actual.valid_upto == expected.valid_upto);
+  }
+}
+
+// code points of every character, and where iteration stopped
+template<typename Policy>
+static std::vector<uint32_t> code_points(std::string_view bytes, size_t* stop = nullptr) {
+  std::vector<uint32_t> result;
+  auto chars = utf8::chars<Policy>(bytes);
+  auto it = chars.begin();
+  for (; it != chars.end(); ++it) result.push_back((*it).code_point());
+  if (stop) *stop = it.base() - bytes.data();
+  return result;
+}
+
+void test_chars_policies() {
+  std::string_view valid = "aЗこ🚩";
+  std::vector<uint32_t> expected = { 0x61, 0x417, 0x3053, 0x1F6A9 };
+  size_t stop;
+  assert(code_points<utf8::trusted>(valid) == expected);
+  assert(code_points<utf8::checked>(valid, &stop) == expected && stop == valid.size());
+  assert(code_points<utf8::lossy>(valid) == expected);
+
+  // checked stops at the invalid sequence, lossy replaces every byte of it
+  std::string_view invalid = "aЗ\xC0\xC0こ";
+  auto checked = utf8::chars<utf8::checked>(invalid);
+  auto it = checked.begin();
+  while (it != checked.end()) ++it;
+  assert(it.at_invalid() && it.base() - invalid.data() == 3);
+  assert((code_points<utf8::checked>(invalid) == std::vector<uint32_t> { 0x61, 0x417 }));
+  assert((code_points<utf8::lossy>(invalid) == std::vector<uint32_t> { 0x61, 0x417, 0xFFFD, 0xFFFD, 0x3053 }));
+
+  // a truncated character at the end is not read past the buffer
+  assert((code_points<utf8::lossy>(std::string_view("a\xE3\x81", 3)) == std::vector<uint32_t> { 0x61, 0xFFFD, 0xFFFD }));
+  assert(!utf8::chars<utf8::checked>().begin().at_invalid());
+}
+
+void test_chars_match_c() {
+  const unsigned char alphabet[] = { 'a', 0x80, 0x9F, 0xA0, 0xBF, 0xC2, 0xDF, 0xE0, 0xED, 0xEF, 0xF0, 0xF4, 0xF7, 0xF8 };
+  srand(7);
+  for (int i = 0; i < 20000; i++) {
+    char buffer[16 + 1];
+    size_t len = rand() % (sizeof(buffer) - 1);
+    for (size_t j = 0; j < len; j++) buffer[j] = alphabet[rand() % sizeof(alphabet)];
+    buffer[len] = '\0';
+
+    // checked stops where validate_utf8_n does
+    size_t stop;
+    code_points<utf8::checked>({ buffer, len }, &stop);
+    utf8_validity validity = validate_utf8_n(buffer, len);
+    assert(stop == validity.valid_upto);
+
+    // lossy yields the characters of make_utf8_string_lossy
+    owned_utf8_string owned = make_utf8_string_lossy(buffer);
+    std::string lossy;
+    for (utf8::character ch : utf8::chars<utf8::lossy>({ buffer, len })) lossy += ch.bytes();
+    assert(lossy == std::string_view(owned.str, owned.byte_len));
+    free_owned_utf8_string(&owned);
+
+    // trusted decodes the valid prefix like unicode_code_point (terminated, as next_utf8_char reads up to '\0')
+    buffer[validity.valid_upto] = '\0';
+    auto trusted = code_points<utf8::trusted>({ buffer, validity.valid_upto });
+    utf8_char_iter iter = make_utf8_char_iter(utf8_string { buffer, validity.valid_upto });
+    for (uint32_t code_point : trusted) {
+      utf8_char ch = next_utf8_char(&iter);
+      assert(code_point == unicode_code_point(ch));
+    }
+  }
+}
+
+void test_chunks() {
+  const char* pieces[] = { "a", "З", "こ", "🚩" };
+  std::string text;
+  srand(3);
+  for (int i = 0; i < 5000; i++) text += pieces[rand() % 4];
+  auto view = *utf8::string_view::from_bytes(text);
+
+  for (size_t chunk_bytes : { 1, 2, 3, 4, 7, 64, 1000, 100000 }) {
+    utf8::chunks chunks(view, chunk_bytes);
+    assert(chunks.size() == (text.size() + chunk_bytes - 1) / chunk_bytes);
+    assert(std::ranges::distance(chunks) == (std::ptrdiff_t)chunks.size());
+
+    // consecutive, valid, and about chunk_bytes long
+    std::string joined;
+    for (utf8::string_view chunk : chunks) {
+      assert(utf8::string_view::from_bytes(chunk.bytes()));
+      assert(chunk.byte_len() <= chunk_bytes + 3);
+      joined += chunk.bytes();
+    }
+    assert(joined == text);
+
+    // random access agrees with iteration
+    auto it = chunks.begin();
+    assert(it[chunks.size() - 1] == *(chunks.end() - 1));
+    assert((it + 2) - it == 2 && it < it + 1);
+  }
+
+  utf8::chunks empty(utf8::string_view(), 16);
+  assert(empty.size() == 0 && empty.begin() == empty.end());
+}
+
+void test_chunks_parallel() {
+  std::string text;
+  for (int i = 0; i < 20000; i++) text += "Hello Здравствуйте こんにちは 🚩😁\n";
+  auto view = *utf8::string_view::from_bytes(text);
+  utf8::chunks chunks(view, 4096);
+
+  std::atomic<size_t> count = 0;
+  std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](utf8::string_view chunk) {
+    count += chunk.char_count();
+  });
+  assert(count == view.char_count());
+
+  size_t lines = std::transform_reduce(std::execution::par, chunks.begin(), chunks.end(), (size_t)0, std::plus<>(),
+    [](utf8::string_view chunk) { return (size_t)std::ranges::count(chunk.bytes(), '\n'); });
+  assert(lines == 20000);
+}
+
+static utf8::generator<int> count_to(int n) {
+  for (int i = 1; i <= n; i++) co_yield i;
+}
+
+void test_generator() {
+  std::vector<int> values;
+  for (int i : count_to(4)) values.push_back(i);
+  assert((values == std::vector<int> { 1, 2, 3, 4 }));
+
+  auto empty = count_to(0);
+  assert(empty.begin() == empty.end());
+}
+
+// feeds `text` cut at `cuts` and returns what the decoder yielded
+static std::string decode_chunks(std::string_view text, std::vector<size_t> cuts, utf8_validity* validity) {
+  utf8::stream_decoder decoder;
+  std::string decoded;
+  size_t start = 0;
+  cuts.push_back(text.size());
+  for (size_t cut : cuts) {
+    std::string chunk(text.substr(start, cut - start));  // owned, like a reused network buffer
+    for (utf8::string_view view : decoder.feed(chunk)) {
+      // a slice of the chunk, or the single character completed in the decoder
+      bool in_chunk = view.data() >= chunk.data() && view.data() + view.byte_len() <= chunk.data() + chunk.size();
+      assert(in_chunk || view.char_count() == 1);
+      decoded += view.bytes();
+    }
+    assert(decoder.validity().valid_upto == decoded.size());
+    start = cut;
+  }
+  *validity = decoder.finish();
+  return decoded;
+}
+
+void test_stream_decoder() {
+  std::string_view text = "aЗこ🚩 Hello Здравствуйте こんにちは 🚩😁";
+  utf8_validity validity;
+
+  // every single and every pair of cuts
+  for (size_t i = 0; i <= text.size(); i++) {
+    assert(decode_chunks(text, { i }, &validity) == text && validity.valid && validity.valid_upto == text.size());
+    for (size_t j = i; j <= text.size(); j += 3)
+      assert(decode_chunks(text, { i, j }, &validity) == text && validity.valid);
+  }
+
+  // one byte at a time: 🚩 is completed in the decoder
+  std::vector<size_t> bytewise;
+  for (size_t i = 1; i < text.size(); i++) bytewise.push_back(i);
+  assert(decode_chunks(text, bytewise, &validity) == text && validity.valid);
+
+  // the valid prefix is yielded, then nothing
+  assert(decode_chunks("aЗ\xC0\x80こ", { 2 }, &validity) == "aЗ" && !validity.valid && validity.valid_upto == 3);
+  assert(decode_chunks("aЗ\xF0\x9F\x9A", { 4 }, &validity) == "aЗ" && !validity.valid && validity.valid_upto == 3);
+}
+
+void test_stream_decoder_code_points() {
+  utf8::stream_decoder decoder;
+  std::vector<uint32_t> code_points;
+  for (std::string_view chunk : { "a\xD0", "\x97\xE3\x81", "\x93\xF0\x9F\x9A", "\xA9" })
+    for (uint32_t code_point : decoder.feed_code_points(chunk)) code_points.push_back(code_point);
+
+  assert((code_points == std::vector<uint32_t> { 0x61, 0x417, 0x3053, 0x1F6A9 }));
+  assert(decoder.finish().valid);
+}
+
+void test_stream_decoder_validates_on_feed() {
+  utf8::stream_decoder decoder;
+  decoder.feed("Здр\xD0");  // never iterated
+  assert(decoder.validity().valid && decoder.validity().valid_upto == 6);
+
+  // 'а' completed from the previous chunk, then the rest of this one
+  std::string decoded;
+  for (utf8::string_view view : decoder.feed("\xB0" "a")) decoded += view.bytes();
+  assert(decoded == "аa" && decoder.validity().valid_upto == 9);
+
+  decoder.feed_code_points("b\xFF");  // never iterated
+  assert(!decoder.validity().valid && decoder.validity().valid_upto == 10);
+  assert(!decoder.finish().valid);
+}
+
+#define TEST(test_fn) test_fn(); ntests++; printf("%s\n", #test_fn);
+int main() {
+  int ntests = 0;
+  TEST(test_string_view_from_bytes);
+  TEST(test_string_view_c_interop);
+  TEST(test_string_view_iteration);
+  TEST(test_string_view_slice);
+  TEST(test_string_lossy);
+  TEST(test_string_move_only);
+  TEST(test_literal);
+  TEST(test_validate_matches_c);
+  TEST(test_chars_policies);
+  TEST(test_chars_match_c);
+  TEST(test_chunks);
+  TEST(test_chunks_parallel);
+  TEST(test_generator);
+  TEST(test_stream_decoder);
+  TEST(test_stream_decoder_code_points);
+  TEST(test_stream_decoder_validates_on_feed);
+
+  printf("\n** %d tests passed **\n", ntests);
+  return 0;
+}
@@ -1,8 +1,91 @@
 #include "utf8.h"
+#include "utf8_swar.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef UTF8_STATS
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef enum {
+    STAT_CALLS,
+    STAT_BYTES_PROCESSED,
+    STAT_INVALID_SEQUENCES,
+    STAT_REPLACEMENTS,
+    STAT_NTH_CHAR_CALLS,
+    STAT_NTH_CHAR_STEPS,
+    STAT_COUNT,
+} utf8_stat;
+
+// Counters of one thread. Only the owning thread writes them (plain load + store, no locked instructions);
+// the atomics only make the concurrent reads in `utf8_stats_snapshot` well defined.
+// Blocks are never freed: when a thread exits its block is released for reuse by a later thread,
+// keeping its counts, so the number of blocks is bounded by the peak number of concurrent threads.
+typedef struct stats_block {
+    _Atomic uint64_t counters[STAT_COUNT];
+    atomic_bool in_use;
+    struct stats_block* next;
+} stats_block;
+
+static _Atomic(stats_block*) stats_blocks = NULL;
+static _Thread_local stats_block* thread_stats_block = NULL;
+static pthread_key_t stats_release_key;
+static pthread_once_t stats_release_key_once = PTHREAD_ONCE_INIT;
+
+static void release_stats_block(void* block) {
+    atomic_store_explicit(&((stats_block*)block)->in_use, false, memory_order_release);
+}
+
+static void create_stats_release_key(void) {
+    pthread_key_create(&stats_release_key, release_stats_block);
+}
+
+static stats_block* acquire_stats_block(void) {
+    stats_block* block = NULL;
+
+    // reuse the block of a thread that has exited
+    for (stats_block* b = atomic_load_explicit(&stats_blocks, memory_order_acquire); b; b = b->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong_explicit(&b->in_use, &expected, true, memory_order_acquire, memory_order_relaxed)) {
+            block = b;
+            break;
+        }
+    }
+
+    if (!block) {
+        block = calloc(1, sizeof(stats_block));
+        if (!block) return NULL; // failed allocation, this call goes uncounted
+        atomic_init(&block->in_use, true);
+
+        stats_block* head = atomic_load_explicit(&stats_blocks, memory_order_relaxed);
+        do block->next = head;
+        while (!atomic_compare_exchange_weak_explicit(&stats_blocks, &head, block, memory_order_release, memory_order_relaxed));
+    }
+
+    pthread_once(&stats_release_key_once, create_stats_release_key);
+    pthread_setspecific(stats_release_key, block);
+
+    return thread_stats_block = block;
+}
+
+static void stat_add(utf8_stat stat, uint64_t n) {
+    stats_block* block = thread_stats_block ? thread_stats_block : acquire_stats_block();
+    if (!block) return;
+
+    uint64_t value = atomic_load_explicit(&block->counters[stat], memory_order_relaxed);
+    atomic_store_explicit(&block->counters[stat], value + n, memory_order_relaxed);
+}
+
+#define STAT_ADD(stat, n) stat_add(STAT_##stat, (n))
+
+#else
+
+#define STAT_ADD(stat, n) ((void)0)
+
+#endif
+
 typedef struct {
     bool valid;
     size_t next_offset;
@@ -77,21 +160,361 @@ utf8_char_validity validate_utf8_char(const char* str, size_t offset) {
     return (utf8_char_validity) { .valid = false, .next_offset = offset };
 }
 
+// Same as `validate_utf8_char` for a buffer of `len` bytes that is not necessarily '\0' terminated.
+static utf8_char_validity validate_utf8_char_n(const char* str, size_t offset, size_t len) {
+    if (len - offset >= 4) return validate_utf8_char(str, offset);
+
+    // near the end, validate a '\0' padded copy so nothing past `len` is read (a '\0' is never a continuation byte)
+    char tail[4] = { 0 };
+    memcpy(tail, str + offset, len - offset);
+
+    utf8_char_validity char_validity = validate_utf8_char(tail, 0);
+    return (utf8_char_validity) { .valid = char_validity.valid, .next_offset = offset + char_validity.next_offset };
+}
+
+// Number of bytes equal to `byte` in an all-ASCII word (no carries between bytes, so the count is exact).
+static size_t count_byte_in_ascii_word(uint64_t word, uint8_t byte) {
+    uint64_t x = word ^ (LOW_BITS * byte);
+    uint64_t zero_bytes = ~(((x & LOW7_BITS) + LOW7_BITS) | x | LOW7_BITS);
+    return (size_t)__builtin_popcountll(zero_bytes);
+}
+
 utf8_validity validate_utf8(const char* str) {
     if (str == NULL) return (utf8_validity) { .valid = false, .valid_upto = 0 };
 
     size_t offset = 0;
     utf8_char_validity char_validity;
 
+    STAT_ADD(CALLS, 1);
+
     while (str[offset] != '\0') {
         char_validity = validate_utf8_char(str, offset);
         if (char_validity.valid) offset = char_validity.next_offset;
+        else {
+            STAT_ADD(BYTES_PROCESSED, offset + 1);
+            STAT_ADD(INVALID_SEQUENCES, 1);
+            return (utf8_validity) { .valid = false, .valid_upto = offset };
+        }
+    }
+
+    STAT_ADD(BYTES_PROCESSED, offset);
+    return (utf8_validity) { .valid = true, .valid_upto = offset };
+}
+
+// The validation loop of `validate_utf8_n` from `offset` on, without statistics.
+static utf8_validity validate_utf8_range(const char* str, size_t offset, size_t byte_len) {
+    utf8_char_validity char_validity;
+
+    while (offset < byte_len) {
+        // fast path: 8 ASCII bytes at a time
+        if (byte_len - offset >= 8 && (load_word(str + offset) & HIGH_BITS) == 0) {
+            offset += 8;
+            continue;
+        }
+
+        char_validity = validate_utf8_char_n(str, offset, byte_len);
+        if (char_validity.valid) offset = char_validity.next_offset;
         else return (utf8_validity) { .valid = false, .valid_upto = offset };
     }
 
     return (utf8_validity) { .valid = true, .valid_upto = offset };
 }
 
+utf8_validity validate_utf8_n(const char* str, size_t byte_len) {
+    if (str == NULL) return (utf8_validity) { .valid = false, .valid_upto = 0 };
+
+    STAT_ADD(CALLS, 1);
+
+    utf8_validity validity = validate_utf8_range(str, 0, byte_len);
+    if (!validity.valid) {
+        STAT_ADD(BYTES_PROCESSED, validity.valid_upto + 1);
+        STAT_ADD(INVALID_SEQUENCES, 1);
+        return validity;
+    }
+
+    STAT_ADD(BYTES_PROCESSED, validity.valid_upto);
+    return validity;
+}
+
+// Validates a short buffer: ASCII is skipped a word at a time, the tail through a zero padded word,
+// and the character by character loop only starts at the first word with a non-ASCII byte.
+static utf8_validity validate_short_utf8(const char* str, size_t byte_len) {
+    size_t offset = 0;
+    while (byte_len - offset >= 8 && (load_word(str + offset) & HIGH_BITS) == 0) offset += 8;
+
+    if (byte_len - offset < 8) {
+        uint64_t tail = 0;
+        memcpy(&tail, str + offset, byte_len - offset);
+        if ((tail & HIGH_BITS) == 0) return (utf8_validity) { .valid = true, .valid_upto = byte_len };
+    }
+
+    return validate_utf8_range(str, offset, byte_len);
+}
+
+void validate_utf8_batch(const char* const* ptrs, const size_t* lens, size_t n, utf8_validity* out) {
+    STAT_ADD(CALLS, 1);
+
+#ifdef UTF8_STATS
+    size_t bytes = 0, invalid = 0;
+#endif
+
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i] == NULL) out[i] = (utf8_validity) { .valid = false, .valid_upto = 0 };
+        else out[i] = validate_short_utf8(ptrs[i], lens[i]);
+
+#ifdef UTF8_STATS
+        if (ptrs[i] == NULL) continue;
+        bytes += out[i].valid ? out[i].valid_upto : out[i].valid_upto + 1;
+        invalid += !out[i].valid;
+#endif
+    }
+
+    STAT_ADD(BYTES_PROCESSED, bytes);
+    STAT_ADD(INVALID_SEQUENCES, invalid);
+}
+
+// true if the `len` bytes at `str` are the start of a multi-byte character whose remaining bytes are missing
+static bool is_incomplete_utf8_char(const char* str, size_t len) {
+    if (len == 0 || utf8_lead_byte_len((uint8_t)str[0]) <= len) return false;
+
+    for (size_t i = 1; i < len; i++)
+        if (((uint8_t)str[i] & 0b11000000) != 0b10000000) return false;
+    return true;
+}
+
+size_t utf8_incomplete_suffix_len(const char* str, size_t byte_len) {
+    for (size_t len = 1; len <= 3 && len <= byte_len; len++) {
+        // find the lead byte of the last character
+        if (((uint8_t)str[byte_len - len] & 0b11000000) != 0b10000000)
+            return is_incomplete_utf8_char(str + byte_len - len, len) ? len : 0;
+    }
+    return 0;
+}
+
+utf8_validator make_utf8_validator(void) {
+    return (utf8_validator) { .validity = { .valid = true, .valid_upto = 0 }, .pending_len = 0 };
+}
+
+utf8_validity feed_utf8_validator(utf8_validator* validator, const char* chunk, size_t byte_len) {
+    if (!validator->validity.valid || byte_len == 0) return validator->validity;
+
+    size_t offset = 0;
+
+    // complete the character left over from the previous chunk
+    if (validator->pending_len > 0) {
+        size_t char_len = utf8_lead_byte_len((uint8_t)validator->pending[0]);
+        while (validator->pending_len < char_len && offset < byte_len)
+            validator->pending[validator->pending_len++] = chunk[offset++];
+
+        if (validator->pending_len < char_len) {
+            // still incomplete, unless a byte that cannot continue it already arrived
+            if (!is_incomplete_utf8_char(validator->pending, validator->pending_len))
+                validator->validity.valid = false;
+            return validator->validity;
+        }
+
+        if (!validate_utf8_char_n(validator->pending, 0, char_len).valid) {
+            validator->validity.valid = false;
+            return validator->validity;
+        }
+
+        validator->validity.valid_upto += char_len;
+        validator->pending_len = 0;
+    }
+
+    utf8_validity validity = validate_utf8_n(chunk + offset, byte_len - offset);
+    validator->validity.valid_upto += validity.valid_upto;
+    if (validity.valid) return validator->validity;
+
+    // keep a character cut by the end of the chunk for the next one
+    size_t rest = byte_len - offset - validity.valid_upto;
+    const char* cut = chunk + offset + validity.valid_upto;
+    if (is_incomplete_utf8_char(cut, rest)) {
+        memcpy(validator->pending, cut, rest);
+        validator->pending_len = (uint8_t)rest;
+    } else {
+        validator->validity.valid = false;
+    }
+
+    return validator->validity;
+}
+
+utf8_validity finish_utf8_validator(utf8_validator* validator) {
+    if (validator->pending_len > 0) validator->validity.valid = false;
+    return validator->validity;
+}
+
+// Tells why `validate_utf8_char` rejected the character at `offset`.
+static utf8_error_kind classify_utf8_error(const char* str, size_t offset) {
+    uint8_t lead = (uint8_t)str[offset];
+
+    size_t char_len;
+    if ((lead & 0b11000000) == 0b10000000) return UTF8_ERROR_BAD_LEAD;
+    else if ((lead & 0b11100000) == 0b11000000) char_len = 2;
+    else if ((lead & 0b11110000) == 0b11100000) char_len = 3;
+    else if ((lead & 0b11111000) == 0b11110000) char_len = 4;
+    else return UTF8_ERROR_OUT_OF_RANGE;
+
+    // stops at the terminating '\0' as it is not a continuation byte
+    for (size_t i = 1; i < char_len; i++)
+        if (((uint8_t)str[offset + i] & 0b11000000) != 0b10000000) return UTF8_ERROR_TRUNCATED;
+
+    // a complete sequence can only be rejected as a surrogate or as overlong (see validate_utf8_char)
+    if (lead == 0b11101101 && (uint8_t)str[offset + 1] >= 0b10100000) return UTF8_ERROR_SURROGATE;
+    return UTF8_ERROR_OVERLONG;
+}
+
+// floor(log2(offset + 1))
+static size_t error_histogram_bucket(size_t offset) {
+    size_t bucket = 0;
+    for (size_t n = offset + 1; n > 1; n >>= 1) bucket++;
+    return bucket;
+}
+
+utf8_error_report diagnose_utf8(const char* str) {
+    utf8_error_report report = { .validity = { .valid = str != NULL, .valid_upto = 0 } };
+    for (size_t i = 0; i < UTF8_ERROR_KIND_COUNT; i++) report.first_offsets[i] = SIZE_MAX;
+
+    if (str == NULL) return report;
+
+    size_t offset = 0;
+    utf8_char_validity char_validity;
+
+    while (str[offset] != '\0') {
+        char_validity = validate_utf8_char(str, offset);
+        if (char_validity.valid) {
+            offset = char_validity.next_offset;
+            continue;
+        }
+
+        utf8_error_kind kind = classify_utf8_error(str, offset);
+        if (report.counts[kind]++ == 0) report.first_offsets[kind] = offset;
+        report.position_histogram[error_histogram_bucket(offset)]++;
+
+        if (report.total_errors++ == 0) report.validity = (utf8_validity) { .valid = false, .valid_upto = offset };
+
+        offset++;
+    }
+
+    if (report.validity.valid) report.validity.valid_upto = offset;
+    report.byte_len = offset;
+
+    STAT_ADD(CALLS, 1);
+    STAT_ADD(BYTES_PROCESSED, offset);
+    STAT_ADD(INVALID_SEQUENCES, report.total_errors);
+
+    return report;
+}
+
+utf8_text_stats scan_utf8_text(const char* str, size_t byte_len) {
+    utf8_text_stats stats = { .validity = { .valid = true, .valid_upto = 0 }, .is_ascii = true };
+    if (str == NULL) {
+        stats.validity.valid = false;
+        return stats;
+    }
+
+    size_t offset = 0;
+    utf8_char_validity char_validity;
+
+    while (offset < byte_len && stats.validity.valid) {
+        // fast path: 8 ASCII bytes at a time
+        while (byte_len - offset >= 8) {
+            uint64_t word = load_word(str + offset);
+            if (word & HIGH_BITS) break;
+
+            stats.char_count += 8;
+            stats.line_count += count_byte_in_ascii_word(word, '\n');
+            offset += 8;
+        }
+        if (offset == byte_len) break;
+
+        // slow path: one character at a time until the next 8 byte window
+        size_t window_end = offset + 8 < byte_len ? offset + 8 : byte_len;
+        while (offset < window_end) {
+            char_validity = validate_utf8_char_n(str, offset, byte_len);
+            if (!char_validity.valid) {
+                stats.validity.valid = false;
+                break;
+            }
+
+            uint8_t char_len = (uint8_t)(char_validity.next_offset - offset);
+            if (char_len > stats.max_char_len) stats.max_char_len = char_len;
+            if (str[offset] == '\n') stats.line_count++;
+            stats.char_count++;
+            offset = char_validity.next_offset;
+        }
+    }
+
+    stats.validity.valid_upto = offset;
+    if (stats.max_char_len > 1) stats.is_ascii = false;
+    else if (stats.char_count > 0) stats.max_char_len = 1;
+
+    STAT_ADD(CALLS, 1);
+    STAT_ADD(BYTES_PROCESSED, stats.validity.valid ? offset : offset + 1);
+    STAT_ADD(INVALID_SEQUENCES, !stats.validity.valid);
+
+    return stats;
+}
+
+utf8_string_info make_utf8_string_info(const char* str, size_t byte_len) {
+    utf8_text_stats stats = scan_utf8_text(str, byte_len);
+    if (!stats.validity.valid) return (utf8_string_info) { .ustr = { .str = NULL, .byte_len = 0 } };
+
+    return (utf8_string_info) {
+        .ustr = { .str = str, .byte_len = byte_len },
+        .char_count = stats.char_count,
+        .is_ascii = stats.is_ascii,
+        .max_char_len = stats.max_char_len,
+    };
+}
+
+// true if every character has the same byte length (ASCII, but also e.g. CJK-only text), so indexing is arithmetic
+static bool has_uniform_char_len(const utf8_string_info* info) {
+    return info->char_count * info->max_char_len == info->ustr.byte_len;
+}
+
+// Byte offset of the character with index `char_index`, or the end of the string if it is `char_count`.
+static size_t cached_char_offset(const utf8_string_info* info, size_t char_index) {
+    if (has_uniform_char_len(info)) return char_index * info->max_char_len;
+
+    // skip whole words while the character is not in them
+    const char* str = info->ustr.str;
+    size_t byte_len = info->ustr.byte_len;
+    size_t offset = 0;
+    while (byte_len - offset >= 8) {
+        size_t starts = count_char_starts_in_word(load_word(str + offset));
+        if (starts > char_index) break;
+        char_index -= starts;
+        offset += 8;
+    }
+
+    // after a whole word, the first bytes may still be continuation bytes of a character counted in it
+    for (; offset < byte_len; offset++) {
+        if (!is_utf8_char_boundary(str + offset)) continue;
+        if (char_index == 0) break;
+        char_index--;
+    }
+    return offset;
+}
+
+utf8_char cached_nth_utf8_char(const utf8_string_info* info, size_t char_index) {
+    if (char_index >= info->char_count) return (utf8_char) { .str = NULL, .byte_len = 0 };
+
+    const char* ch = info->ustr.str + cached_char_offset(info, char_index);
+    uint8_t byte_len = has_uniform_char_len(info) ? info->max_char_len : utf8_lead_byte_len((uint8_t)*ch);
+    return (utf8_char) { .str = ch, .byte_len = byte_len };
+}
+
+utf8_string cached_slice_utf8_chars(const utf8_string_info* info, size_t start_char_index, size_t char_len) {
+    if (info->ustr.str == NULL) return (utf8_string) { .str = NULL, .byte_len = 0 };
+    if (start_char_index > info->char_count) start_char_index = info->char_count;
+    if (char_len > info->char_count - start_char_index) char_len = info->char_count - start_char_index;
+
+    size_t start = cached_char_offset(info, start_char_index);
+    size_t end = cached_char_offset(info, start_char_index + char_len);
+    return (utf8_string) { .str = info->ustr.str + start, .byte_len = end - start };
+}
+
 utf8_string make_utf8_string(const char* str) {
     utf8_validity validity = validate_utf8(str);
     if (validity.valid) return (utf8_string) { .str = str, .byte_len = validity.valid_upto };
@@ -112,6 +535,7 @@ owned_utf8_string make_utf8_string_lossy(const char* str) {
 
     size_t buffer_offset = 0;
     size_t offset = 0;
+    size_t replacements = 0;
     utf8_char_validity char_validity;
 
     while (offset < len) {
@@ -133,11 +557,17 @@ owned_utf8_string make_utf8_string_lossy(const char* str) {
             buffer[buffer_offset++] = 0xBF;
             buffer[buffer_offset++] = 0xBD;
             offset++;
+            replacements++;
         }
     }
 
     buffer[buffer_offset] = '\0';
 
+    STAT_ADD(CALLS, 1);
+    STAT_ADD(BYTES_PROCESSED, len);
+    STAT_ADD(INVALID_SEQUENCES, replacements);
+    STAT_ADD(REPLACEMENTS, replacements);
+
     return (owned_utf8_string) { .str = buffer, .byte_len = buffer_offset };
 }
 
@@ -191,12 +621,49 @@ utf8_char next_utf8_char(utf8_char_iter* iter) {
     return (utf8_char) { .str = curr_boundary, .byte_len = byte_len };
 }
 
+static const char replacement_char[] = "\xEF\xBF\xBD";
+
+utf8_lossy_iter make_utf8_lossy_iter(const char* str, size_t byte_len) {
+    if (str == NULL) return (utf8_lossy_iter) { .str = NULL, .end = NULL, .replacements = 0 };
+    return (utf8_lossy_iter) { .str = str, .end = str + byte_len, .replacements = 0 };
+}
+
+utf8_char next_utf8_lossy_char(utf8_lossy_iter* iter) {
+    if (iter->str == iter->end) return (utf8_char) { .str = iter->end, .byte_len = 0 };
+
+    const char* curr = iter->str;
+    if ((uint8_t)*curr <= 0b01111111) {
+        iter->str++;
+        return (utf8_char) { .str = curr, .byte_len = 1 };
+    }
+
+    utf8_char_validity char_validity = validate_utf8_char_n(curr, 0, (size_t)(iter->end - curr));
+    if (char_validity.valid) {
+        iter->str += char_validity.next_offset;
+        return (utf8_char) { .str = curr, .byte_len = (uint8_t)char_validity.next_offset };
+    }
+
+    // like make_utf8_string_lossy: one U+FFFD per invalid byte
+    iter->str++;
+    iter->replacements++;
+    return (utf8_char) { .str = replacement_char, .byte_len = 3 };
+}
+
 utf8_char nth_utf8_char(utf8_string ustr, size_t char_index) {
     utf8_char_iter iter = make_utf8_char_iter(ustr);
 
+#ifdef UTF8_STATS
+    size_t remaining = char_index;
+#endif
+
     utf8_char ch;
     while ((ch = next_utf8_char(&iter)).byte_len != 0 && char_index-- != 0) {}
 
+    STAT_ADD(CALLS, 1);
+    STAT_ADD(NTH_CHAR_CALLS, 1);
+    STAT_ADD(NTH_CHAR_STEPS, remaining - char_index);
+    STAT_ADD(BYTES_PROCESSED, (size_t)(iter.str - ustr.str));
+
     if (ch.byte_len == 0) return (utf8_char) { .str = NULL, .byte_len = 0 };
     return ch;
 }
@@ -206,6 +673,28 @@ size_t utf8_char_count(utf8_string ustr) {
 
     size_t count = 0;
     while (next_utf8_char(&iter).byte_len > 0) count++;
+
+    STAT_ADD(CALLS, 1);
+    STAT_ADD(BYTES_PROCESSED, (size_t)(iter.str - ustr.str));
+
+    return count;
+}
+
+size_t utf8_char_index_of(utf8_string ustr, size_t byte_offset) {
+    if (ustr.str == NULL) return 0;
+    if (byte_offset > ustr.byte_len) byte_offset = ustr.byte_len;
+
+    // the character at the offset starts at or before it
+    while (byte_offset > 0 && byte_offset < ustr.byte_len && !is_utf8_char_boundary(ustr.str + byte_offset)) byte_offset--;
+
+    size_t count = 0;
+    size_t offset = 0;
+    for (; byte_offset - offset >= 8; offset += 8) count += count_char_starts_in_word(load_word(ustr.str + offset));
+    for (; offset < byte_offset; offset++) count += is_utf8_char_boundary(ustr.str + offset);
+
+    STAT_ADD(CALLS, 1);
+    STAT_ADD(BYTES_PROCESSED, byte_offset);
+
     return count;
 }
 
@@ -228,3 +717,20 @@ uint32_t unicode_code_point(utf8_char uchar) {
 
     return 0; // unreachable
 }
+
+utf8_stats utf8_stats_snapshot(void) {
+    utf8_stats stats = { 0 };
+
+#ifdef UTF8_STATS
+    for (stats_block* b = atomic_load_explicit(&stats_blocks, memory_order_acquire); b; b = b->next) {
+        stats.calls += atomic_load_explicit(&b->counters[STAT_CALLS], memory_order_relaxed);
+        stats.bytes_processed += atomic_load_explicit(&b->counters[STAT_BYTES_PROCESSED], memory_order_relaxed);
+        stats.invalid_sequences += atomic_load_explicit(&b->counters[STAT_INVALID_SEQUENCES], memory_order_relaxed);
+        stats.replacements += atomic_load_explicit(&b->counters[STAT_REPLACEMENTS], memory_order_relaxed);
+        stats.nth_char_calls += atomic_load_explicit(&b->counters[STAT_NTH_CHAR_CALLS], memory_order_relaxed);
+        stats.nth_char_steps += atomic_load_explicit(&b->counters[STAT_NTH_CHAR_STEPS], memory_order_relaxed);
+    }
+#endif
+
+    return stats;
+}
@@ -33,6 +33,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @brief Represents the validity of a UTF-8 encoded string.
  *
@@ -79,6 +83,17 @@ typedef struct {
     const char* str;     ///< Pointer to the current position of the iterator.
 } utf8_char_iter;
 
+/**
+ * @brief Represents an iterator over untrusted bytes that yields U+FFFD REPLACEMENT CHARACTER (�) for invalid sequences.
+ *
+ * @details See `make_utf8_lossy_iter` and `next_utf8_lossy_char`.
+ */
+typedef struct {
+    const char* str;        ///< Pointer to the current position of the iterator.
+    const char* end;        ///< Pointer past the last byte.
+    size_t replacements;    ///< Number of U+FFFD returned so far.
+} utf8_lossy_iter;
+
 /**
  * @brief Represents a UTF-8 character.
  *
@@ -98,6 +113,109 @@ typedef struct {
  */
 utf8_validity validate_utf8(const char* str);
 
+/**
+ * @brief Validates whether the first `byte_len` bytes of a buffer are UTF-8 compliant in O(n) time.
+ *
+ * @details Unlike `validate_utf8`, the buffer does not need to be '\0' terminated and '\0' bytes inside it are valid characters.
+ *          A character cut by `byte_len` is invalid. Runs of ASCII are validated 8 bytes at a time.
+ *
+ * @param str The buffer to validate.
+ * @param byte_len The number of bytes to validate.
+ * @return The validity of the buffer along with the position up to which it is valid.
+ */
+utf8_validity validate_utf8_n(const char* str, size_t byte_len);
+
+/**
+ * @brief Validates many short buffers in one call, as `validate_utf8_n` would validate each of them.
+ *
+ * @details Meant for messages made of many small fields (tens of bytes), where the per-call overhead of
+ *          `validate_utf8_n` dominates. The buffers are processed back to back without per-call setup; ASCII is
+ *          skipped a word at a time (the tail of a buffer through a zero padded word), and only buffers with
+ *          non-ASCII bytes are validated character by character from their first non-ASCII word on.
+ *
+ * @param ptrs The buffers. A NULL buffer is invalid.
+ * @param lens The byte length of every buffer.
+ * @param n The number of buffers.
+ * @param out Receives the validity of `ptrs[i]` in `out[i]`.
+ *
+ * @code
+ * // Example usage:
+ * const char* fields[] = { "name", "Здравствуйте", "\xC0" };
+ * size_t lens[] = { 4, 24, 1 };
+ * utf8_validity out[3];
+ * validate_utf8_batch(fields, lens, 3, out);
+ * // out[0].valid == true, out[1].valid == true, out[2].valid == false
+ * @endcode
+ */
+void validate_utf8_batch(const char* const* ptrs, const size_t* lens, size_t n, utf8_validity* out);
+
+/**
+ * @brief Length of an incomplete character at the end of a buffer, for processing text in chunks.
+ *
+ * @details When a stream is cut into chunks, the last character of a chunk may continue in the next one.
+ *          Such a character is the start of a multi-byte sequence (lead byte and any continuation bytes)
+ *          that is shorter than its lead byte announces.
+ *
+ * @param str The chunk.
+ * @param byte_len The number of bytes in the chunk.
+ * @return The number of trailing bytes (0 to 3) that belong to an incomplete character.
+ *
+ * @code
+ * // Example usage:
+ * assert( utf8_incomplete_suffix_len("abc\xF0\x9F", 5) == 2 );    // first half of 😁
+ * assert( utf8_incomplete_suffix_len("abc\xC0", 4) == 1 );        // C0 announces 2 bytes (and is invalid anyway)
+ * assert( utf8_incomplete_suffix_len("abcд", 5) == 0 );
+ * @endcode
+ */
+size_t utf8_incomplete_suffix_len(const char* str, size_t byte_len);
+
+/**
+ * @brief Resumable validator for UTF-8 text that arrives in chunks (see `feed_utf8_validator`).
+ *
+ * @details A character split across two chunks is kept in `pending` (at most 3 bytes) until the rest arrives,
+ *          so chunks can be cut at any byte.
+ */
+typedef struct {
+    utf8_validity validity;  ///< Validity of the stream so far; `valid_upto` counts validated bytes (pending bytes excluded).
+    char pending[4];         ///< Leading bytes of a character that continues in the next chunk.
+    uint8_t pending_len;     ///< Number of bytes in `pending`.
+} utf8_validator;
+
+/**
+ * @brief Creates a validator for a new stream.
+ */
+utf8_validator make_utf8_validator(void);
+
+/**
+ * @brief Validates the next chunk of a stream in O(n) time.
+ *
+ * @details Once an invalid sequence is found, the validator stays invalid and further chunks are ignored.
+ *          Like `validate_utf8_n`, '\0' bytes are valid characters.
+ *
+ * @param validator The validator of the stream.
+ * @param chunk The next bytes of the stream.
+ * @param byte_len The number of bytes in `chunk`.
+ * @return The validity of the stream so far. `valid_upto` is a byte offset from the start of the stream.
+ *
+ * @code
+ * // Example usage:
+ * utf8_validator validator = make_utf8_validator();
+ * feed_utf8_validator(&validator, "Hello \xD0", 7);   // Д split across chunks
+ * feed_utf8_validator(&validator, "\x94!", 2);
+ * utf8_validity validity = finish_utf8_validator(&validator);
+ * assert( validity.valid && validity.valid_upto == 9 );
+ * @endcode
+ */
+utf8_validity feed_utf8_validator(utf8_validator* validator, const char* chunk, size_t byte_len);
+
+/**
+ * @brief Ends the stream: a character still waiting for its remaining bytes makes the stream invalid.
+ *
+ * @param validator The validator of the stream.
+ * @return The validity of the whole stream.
+ */
+utf8_validity finish_utf8_validator(utf8_validator* validator);
+
 /**
  * @brief Wraps a C-style string in a UTF-8 string structure after verifying its UTF-8 compliance.
  *
@@ -198,6 +316,37 @@ utf8_char_iter make_utf8_char_iter(utf8_string ustr);
  */
 utf8_char next_utf8_char(utf8_char_iter* iter);
 
+/**
+ * @brief Creates an iterator over bytes that may be invalid UTF-8. (see next_utf8_lossy_char( .. ) for traversal)
+ *
+ * @param str The bytes to iterate over, which do not need to be '\0' terminated.
+ * @param byte_len The number of bytes.
+ * @return An iterator initialized to the start of the bytes.
+ */
+utf8_lossy_iter make_utf8_lossy_iter(const char* str, size_t byte_len);
+
+/**
+ * @brief Retrieves the next character, or U+FFFD REPLACEMENT CHARACTER (�) for an invalid byte, without allocating.
+ *
+ * @details Yields the same characters as iterating the result of `make_utf8_string_lossy`: a valid character as is,
+ *          and one U+FFFD for every byte that does not start a valid character, after which iteration resumes at the
+ *          next byte. So untrusted input can be processed lossily in a single pass, without the copy of up to 3 times
+ *          its size. The U+FFFD characters point to a static "\xEF\xBF\xBD", not into the input.
+ *          ASCII bytes are returned without validating them.
+ *
+ * @param iter Pointer to the iterator.
+ * @return The next character, or { .str = iter->end, .byte_len = 0 } at the end.
+ *
+ * @code
+ * // Example usage:
+ * const char* str = "hello\xC0\xC0 world!";
+ * utf8_lossy_iter iter = make_utf8_lossy_iter(str, strlen(str));
+ * utf8_char ch;
+ * while ((ch = next_utf8_lossy_char(&iter)).byte_len > 0) printf("%.*s", (int)ch.byte_len, ch.str);    // hello�� world!
+ * @endcode
+ */
+utf8_char next_utf8_lossy_char(utf8_lossy_iter* iter);
+
 /**
  * @brief Retrieves the UTF-8 character at the specified character index within a UTF-8 string in O(n) time.
  *
@@ -226,6 +375,28 @@ utf8_char nth_utf8_char(utf8_string ustr, size_t char_index);
  */
 size_t utf8_char_count(utf8_string ustr);
 
+/**
+ * @brief Finds the index of the character at byte offset `byte_offset`, the inverse of `nth_utf8_char`, in O(n) time.
+ *
+ * @details Counts the bytes before `byte_offset` that start a character (that are not continuation bytes),
+ *          8 bytes at a time, so it is much cheaper than counting with `next_utf8_char` (e.g. to report the character
+ *          position of a search hit). Unlike `utf8_char_count`, the string is bounded by `ustr.byte_len` only and
+ *          '\0' bytes are counted like other characters. See `indexed_utf8_char_index_of` in `utf8_position.h` to
+ *          convert many offsets in a long string.
+ *
+ * @param ustr The UTF-8 string.
+ * @param byte_offset The byte offset. An offset inside a character gives the index of that character, an offset
+ *        at or beyond the end gives the number of characters.
+ * @return The zero-based index of the character.
+ *
+ * @code
+ * // Example usage:
+ * utf8_string str = make_utf8_string("Hello Здравствуйте こんにちは");
+ * size_t char_index = utf8_char_index_of(str, 8);    // 7 (д)
+ * @endcode
+ */
+size_t utf8_char_index_of(utf8_string ustr, size_t byte_offset);
+
 /**
  * @brief Checks if a given byte is the start of a UTF-8 character. ('\0' is also a valid character boundary)
  *
@@ -242,4 +413,182 @@ bool is_utf8_char_boundary(const char* str);
  */
 uint32_t unicode_code_point(utf8_char uchar);
 
+/**
+ * @brief Kinds of invalid UTF-8 sequences distinguished by `diagnose_utf8`.
+ */
+typedef enum {
+    UTF8_ERROR_BAD_LEAD,       ///< A continuation byte (10xxxxxx) where a character should start.
+    UTF8_ERROR_TRUNCATED,      ///< A lead byte that is not followed by enough continuation bytes.
+    UTF8_ERROR_OVERLONG,       ///< A character encoded with more bytes than necessary (e.g. C0 80 for '\0').
+    UTF8_ERROR_SURROGATE,      ///< An encoded UTF-16 surrogate (U+D800 to U+DFFF).
+    UTF8_ERROR_OUT_OF_RANGE,   ///< A lead byte of the obsolete 5 and 6 byte forms (F8 to FF).
+    UTF8_ERROR_KIND_COUNT,
+} utf8_error_kind;
+
+/**
+ * @brief Number of buckets of `utf8_error_report.position_histogram`.
+ */
+#define UTF8_ERROR_HISTOGRAM_BUCKETS 64
+
+/**
+ * @brief Result of a full diagnostic scan of a string (see `diagnose_utf8`).
+ *
+ * @details Errors are counted the same way `make_utf8_string_lossy` replaces them: after an invalid sequence
+ *          the scan resumes at the next byte, so `total_errors` is the number of U+FFFD that a lossy conversion inserts.
+ *
+ *          Bucket `b` of `position_histogram` counts errors at byte offsets in [2^b - 1, 2^(b+1) - 1),
+ *          i.e. bucket 0 is offset 0, bucket 1 is offsets 1-2, bucket 2 is offsets 3-6 and so on.
+ */
+typedef struct {
+    utf8_validity validity;                                   ///< Same as `validate_utf8` would return.
+    size_t byte_len;                                          ///< Number of bytes scanned ('\0' not counted).
+    size_t total_errors;                                      ///< Number of invalid sequences.
+    size_t counts[UTF8_ERROR_KIND_COUNT];                     ///< Number of invalid sequences of each kind.
+    size_t first_offsets[UTF8_ERROR_KIND_COUNT];              ///< Byte offset of the first error of each kind, `SIZE_MAX` if there is none.
+    size_t position_histogram[UTF8_ERROR_HISTOGRAM_BUCKETS];  ///< Errors by byte offset on a log2 scale.
+} utf8_error_report;
+
+/**
+ * @brief Scans the whole string once and classifies every invalid UTF-8 sequence in O(n) time.
+ *
+ * @details Unlike `validate_utf8` it does not stop at the first error, so a single pass over dirty input
+ *          tells what kind of damage it has and where it starts.
+ *
+ * @param str The input string to diagnose.
+ * @return The error report. For a `NULL` string, a report with { .valid = false, .valid_upto = 0 } and no errors.
+ *
+ * @code
+ * // Example usage:
+ * utf8_error_report report = diagnose_utf8("hello\xC0\x80 \xED\xA0\x80");
+ * assert( report.validity.valid_upto == 5 );
+ * assert( report.counts[UTF8_ERROR_OVERLONG] == 1 );
+ * assert( report.first_offsets[UTF8_ERROR_SURROGATE] == 8 );
+ * @endcode
+ */
+utf8_error_report diagnose_utf8(const char* str);
+
+/**
+ * @brief Statistics gathered by `scan_utf8_text` in a single pass.
+ *
+ * @details If the text is invalid, the counts describe the valid prefix [0, validity.valid_upto) only.
+ */
+typedef struct {
+    utf8_validity validity;  ///< Same as `validate_utf8` would return for the text.
+    size_t char_count;       ///< Number of characters (code points).
+    size_t line_count;       ///< Number of '\n' characters (like `wc -l`, a last line without '\n' is not counted).
+    bool is_ascii;           ///< `true` if every character is a single byte.
+    uint8_t max_char_len;    ///< Byte length of the longest character, 0 for empty text.
+} utf8_text_stats;
+
+/**
+ * @brief Validates a text and counts its characters and lines in a single O(n) pass.
+ *
+ * @details Replaces calling `validate_utf8`, `utf8_char_count` and counting '\n' separately, which reads the text three times.
+ *          Runs of ASCII are processed 8 bytes at a time. Because the length is given, the text does not need to be
+ *          '\0' terminated and '\0' bytes inside it are counted as characters.
+ *
+ * @param str The text to scan.
+ * @param byte_len The number of bytes to scan.
+ * @return The validity of the text along with its character and line counts.
+ *
+ * @code
+ * // Example usage:
+ * const char* text = "Hello\nЗдравствуйте\n";
+ * utf8_text_stats stats = scan_utf8_text(text, strlen(text));
+ * assert( stats.validity.valid && stats.char_count == 19 && stats.line_count == 2 && !stats.is_ascii );
+ * @endcode
+ */
+utf8_text_stats scan_utf8_text(const char* str, size_t byte_len);
+
+/**
+ * @brief A validated UTF-8 string with the metadata gathered while validating it.
+ *
+ * @details `utf8_string` only has the bytes, so `utf8_char_count` and `nth_utf8_char` walk them on every call.
+ *          Made by `make_utf8_string_info`, this view keeps the character count and the length of the characters,
+ *          so that counting is free and, when every character has the same byte length (always the case for ASCII),
+ *          `cached_nth_utf8_char` and `cached_slice_utf8_chars` are O(1).
+ */
+typedef struct {
+    utf8_string ustr;        ///< The string, { NULL, 0 } if it is invalid.
+    size_t char_count;       ///< Number of characters (code points), '\0' bytes included.
+    bool is_ascii;           ///< `true` if every character is a single byte.
+    uint8_t max_char_len;    ///< Byte length of the longest character, 0 for the empty string.
+} utf8_string_info;
+
+/**
+ * @brief Validates a string and gathers its metadata in a single O(n) pass (see `scan_utf8_text`).
+ *
+ * @param str The string, which does not need to be '\0' terminated.
+ * @param byte_len The number of bytes of the string.
+ * @return The string with its metadata, or { .ustr = { NULL, 0 } } if it is invalid.
+ *
+ * @code
+ * // Example usage:
+ * utf8_string_info info = make_utf8_string_info("Hello", 5);
+ * assert( info.char_count == 5 && info.is_ascii );
+ * utf8_char ch = cached_nth_utf8_char(&info, 4);    // o, without walking the string
+ * @endcode
+ */
+utf8_string_info make_utf8_string_info(const char* str, size_t byte_len);
+
+/**
+ * @brief Same as `nth_utf8_char`, in O(1) time if every character has the same byte length and otherwise in O(n) time,
+ *        counting characters 8 bytes at a time. An index out of bounds is rejected in O(1) time.
+ *
+ * @details Unlike `nth_utf8_char`, the string is bounded by its byte length and '\0' bytes are characters like any other.
+ */
+utf8_char cached_nth_utf8_char(const utf8_string_info* info, size_t char_index);
+
+/**
+ * @brief Slices a string by character indices, in O(1) time if every character has the same byte length.
+ *
+ * @param info The string.
+ * @param start_char_index The index of the first character of the slice, clamped to the number of characters.
+ * @param char_len The number of characters of the slice, clamped to the end of the string.
+ * @return The slice, which always starts and ends at character boundaries, or { NULL, 0 } for an invalid string.
+ *
+ * @code
+ * // Example usage:
+ * utf8_string_info info = make_utf8_string_info("こんにちは", 15);
+ * utf8_string slice = cached_slice_utf8_chars(&info, 1, 2);    // んに
+ * @endcode
+ */
+utf8_string cached_slice_utf8_chars(const utf8_string_info* info, size_t start_char_index, size_t char_len);
+
+/**
+ * @brief Snapshot of the library's runtime statistics counters.
+ *
+ * @details Counters are only maintained when the library is compiled with `UTF8_STATS` defined
+ *          (e.g. `gcc -DUTF8_STATS -pthread -c utf8.c`); otherwise the counting code is compiled out entirely
+ *          and every snapshot is all zeros.
+ *
+ *          Each thread counts into its own block, so counting needs no locks or atomic read-modify-write
+ *          instructions. All counters are monotonic, which is what most metrics systems expect;
+ *          compute rates from the difference between two snapshots.
+ *
+ *          Per-character functions (`next_utf8_char`, `is_utf8_char_boundary`, ...) are not counted.
+ */
+typedef struct {
+    uint64_t calls;              ///< Calls to `validate_utf8` (and therefore `make_utf8_string`), `validate_utf8_n`, `validate_utf8_batch`, `make_utf8_string_lossy`, `diagnose_utf8`, `scan_utf8_text`, `utf8_char_count`, `utf8_char_index_of` and `nth_utf8_char`.
+    uint64_t bytes_processed;    ///< Input bytes examined by those calls.
+    uint64_t invalid_sequences;  ///< Invalid UTF-8 sequences found.
+    uint64_t replacements;       ///< U+FFFD REPLACEMENT CHARACTERs inserted by lossy conversions.
+    uint64_t nth_char_calls;     ///< Calls to `nth_utf8_char`.
+    uint64_t nth_char_steps;     ///< Characters walked by `nth_utf8_char` (steps / calls is the average walk length).
+} utf8_stats;
+
+/**
+ * @brief Sums the statistics counters of all threads that have used the library.
+ *
+ * @details Safe to call concurrently with any library function. Counts of threads that have exited are kept.
+ *          The snapshot is not atomic across counters: a call running concurrently may be partially included.
+ *
+ * @return The current counters, or all zeros if the library was compiled without `UTF8_STATS`.
+ */
+utf8_stats utf8_stats_snapshot(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
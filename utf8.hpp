@@ -0,0 +1,854 @@
+/**
+ * @file utf8.hpp
+ * @brief C++20 interface of utf8.h: a validated `utf8::string_view`, a move-only `utf8::string` and character ranges
+ *
+ * @details Header only. Every type is a thin wrapper over the C structs of utf8.h and calls the C functions
+ *          for validation, decoding and allocation, so nothing is copied that the C API would not copy.
+ *
+ * @code
+ * #include "utf8.hpp"
+ * #include <iostream>
+ *
+ * int main() {
+ *     auto view = utf8::string_view::from_bytes("Hello, こんにちは, Здравствуйте");
+ *     if (!view) return 1;
+ *
+ *     for (utf8::character ch : *view)
+ *         std::cout << ch.bytes() << " U+" << std::hex << ch.code_point() << '\n';
+ *
+ *     utf8::string owned = utf8::string::lossy("hello\xC0\xC0 world!");
+ *     std::cout << owned.c_str() << " (" << std::dec << owned.view().char_count() << " characters)\n";
+ *     return 0;
+ * }
+ * @endcode
+ */
+
+#ifndef ZAHASH_UTF8_HPP
+#define ZAHASH_UTF8_HPP
+
+#include "utf8.h"
+
+#include <compare>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace utf8 {
+
+/**
+ * @brief Byte length of the character starting with lead byte `lead`, assuming the encoding is valid.
+ */
+constexpr std::size_t char_byte_len(unsigned char lead) noexcept {
+    if (lead < 0x80) return 1;
+    if (lead < 0xE0) return 2;
+    if (lead < 0xF0) return 3;
+    return 4;
+}
+
+/**
+ * @brief Whether `byte` starts a character, i.e. is not a continuation byte (10xxxxxx).
+ */
+constexpr bool is_char_boundary(unsigned char byte) noexcept {
+    return (byte & 0xC0) != 0x80;
+}
+
+namespace detail {
+
+// the byte at `i`, '\0' past the end (a '\0' is never a continuation byte)
+constexpr unsigned char byte_at(std::string_view bytes, std::size_t i) noexcept {
+    return i < bytes.size() ? static_cast<unsigned char>(bytes[i]) : 0;
+}
+
+constexpr bool is_continuation(unsigned char byte) noexcept {
+    return (byte & 0xC0) == 0x80;
+}
+
+// Byte length of the character at `offset` if it is valid, 0 otherwise. Same rules as `validate_utf8_char`.
+constexpr std::size_t valid_char_len(std::string_view bytes, std::size_t offset) noexcept {
+    unsigned char b0 = byte_at(bytes, offset);
+    unsigned char b1 = byte_at(bytes, offset + 1);
+    unsigned char b2 = byte_at(bytes, offset + 2);
+    unsigned char b3 = byte_at(bytes, offset + 3);
+
+    if (b0 < 0x80) return 1;
+
+    if ((b0 & 0xE0) == 0xC0 && is_continuation(b1))
+        return (b0 & 0x1F) < 0x02 ? 0 : 2;  // overlong
+
+    if ((b0 & 0xF0) == 0xE0 && is_continuation(b1) && is_continuation(b2)) {
+        if ((b0 & 0x0F) == 0 && (b1 & 0x3F) < 0x20) return 0;  // overlong
+        if (b0 == 0xED && b1 >= 0xA0) return 0;              // UTF-16 surrogate
+        return 3;
+    }
+
+    if ((b0 & 0xF8) == 0xF0 && is_continuation(b1) && is_continuation(b2) && is_continuation(b3))
+        return (b0 & 0x07) == 0 && (b1 & 0x3F) < 0x10 ? 0 : 4;  // overlong
+
+    return 0;
+}
+
+// Same as `validate_utf8_n`, evaluable at compile time.
+constexpr utf8_validity validate_bytes(std::string_view bytes) noexcept {
+    std::size_t offset = 0;
+    while (offset < bytes.size()) {
+        std::size_t len = valid_char_len(bytes, offset);
+        if (len == 0) return { false, offset };
+        offset += len;
+    }
+    return { true, offset };
+}
+
+// U+FFFD REPLACEMENT CHARACTER, yielded by `lossy` iterators for invalid bytes
+inline constexpr char replacement_character[] = "\xEF\xBF\xBD";
+
+} // namespace detail
+
+/**
+ * @brief Same as `validate_utf8_n`, and usable in constant expressions: validates at compile time when
+ *        constant evaluated, and with the C validator otherwise. Empty input is valid, whatever its pointer.
+ */
+constexpr utf8_validity validate(std::string_view bytes) noexcept {
+    if (bytes.empty()) return { true, 0 };
+    if (std::is_constant_evaluated()) return detail::validate_bytes(bytes);
+    return validate_utf8_n(bytes.data(), bytes.size());
+}
+
+/**
+ * @brief A single UTF-8 character: a view of its 1 to 4 bytes (see `utf8_char`).
+ */
+class character {
+public:
+    constexpr character() noexcept = default;
+    constexpr character(utf8_char ch) noexcept : ch_(ch) {}
+
+    constexpr const char* data() const noexcept { return ch_.str; }
+    constexpr std::size_t byte_len() const noexcept { return ch_.byte_len; }
+    constexpr std::string_view bytes() const noexcept { return { ch_.str, ch_.byte_len }; }
+
+    /**
+     * @brief The Unicode code point of the character, decoded inline like `unicode_code_point` does.
+     */
+    constexpr std::uint32_t code_point() const noexcept {
+        auto b = [this](int i) { return static_cast<std::uint32_t>(static_cast<unsigned char>(ch_.str[i])); };
+        switch (ch_.byte_len) {
+        case 1: return b(0);
+        case 2: return (b(0) & 0x1F) << 6 | (b(1) & 0x3F);
+        case 3: return (b(0) & 0x0F) << 12 | (b(1) & 0x3F) << 6 | (b(2) & 0x3F);
+        case 4: return (b(0) & 0x07) << 18 | (b(1) & 0x3F) << 12 | (b(2) & 0x3F) << 6 | (b(3) & 0x3F);
+        }
+        return 0;
+    }
+
+    constexpr operator utf8_char() const noexcept { return ch_; }
+
+    friend constexpr bool operator==(character a, character b) noexcept { return a.bytes() == b.bytes(); }
+
+private:
+    utf8_char ch_ = { nullptr, 0 };
+};
+
+/**
+ * @brief Iteration policy for bytes known to be valid UTF-8: characters are not checked at all.
+ */
+struct trusted {};
+
+/**
+ * @brief Iteration policy for untrusted bytes: every character is validated as it is read,
+ *        and iteration stops at the first invalid sequence.
+ */
+struct checked {};
+
+/**
+ * @brief Iteration policy for untrusted bytes: every character is validated as it is read, and every byte that does
+ *        not start a valid character yields U+FFFD REPLACEMENT CHARACTER (�), like `make_utf8_string_lossy` replaces it.
+ */
+struct lossy {};
+
+/**
+ * @brief Iterator over the characters of a UTF-8 buffer, validating them as `Policy` says.
+ *
+ * @details The `checked` and `lossy` iterators are forward iterators that know the end of their buffer and
+ *          compare equal to `std::default_sentinel` once iteration is over. The `trusted` iterator is specialized below.
+ */
+template<typename Policy>
+class basic_char_iterator {
+    static_assert(std::is_same_v<Policy, checked> || std::is_same_v<Policy, lossy>, "unknown iteration policy");
+
+public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = character;
+    using reference = character;
+    using difference_type = std::ptrdiff_t;
+
+    constexpr basic_char_iterator() noexcept = default;
+    constexpr basic_char_iterator(const char* pos, const char* end) noexcept : pos_(pos), end_(end), len_(decode()) {}
+
+    /**
+     * @brief The position of the current character in the buffer. Where a `checked` iteration stopped, the
+     *        position of the invalid sequence (that is `valid_upto` of the buffer).
+     */
+    constexpr const char* base() const noexcept { return pos_; }
+
+    /**
+     * @brief Whether a `checked` iteration stopped at an invalid sequence rather than at the end of the buffer.
+     */
+    constexpr bool at_invalid() const noexcept { return pos_ != end_ && len_ == 0; }
+
+    constexpr character operator*() const noexcept {
+        if constexpr (std::is_same_v<Policy, lossy>)
+            if (len_ == 0) return utf8_char { detail::replacement_character, 3 };
+        return utf8_char { pos_, len_ };
+    }
+
+    constexpr basic_char_iterator& operator++() noexcept {
+        pos_ += len_ ? len_ : 1;
+        len_ = decode();
+        return *this;
+    }
+
+    constexpr basic_char_iterator operator++(int) noexcept {
+        basic_char_iterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    friend constexpr bool operator==(const basic_char_iterator& a, const basic_char_iterator& b) noexcept { return a.pos_ == b.pos_; }
+
+    friend constexpr bool operator==(const basic_char_iterator& it, std::default_sentinel_t) noexcept {
+        if constexpr (std::is_same_v<Policy, checked>) return it.len_ == 0;
+        else return it.pos_ == it.end_;
+    }
+
+private:
+    // byte length of the character at pos_, 0 at the end or if it is invalid
+    constexpr std::uint8_t decode() const noexcept {
+        if (pos_ == end_) return 0;
+        if (static_cast<unsigned char>(*pos_) < 0x80) return 1;
+        return static_cast<std::uint8_t>(detail::valid_char_len({ pos_, static_cast<std::size_t>(end_ - pos_) }, 0));
+    }
+
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+    std::uint8_t len_ = 0;
+};
+
+/**
+ * @brief Bidirectional iterator over the characters of a valid UTF-8 buffer.
+ *
+ * @details Dereferencing yields a `character` by value. Advancing reads the length from the lead byte instead of
+ *          scanning for the next boundary like `next_utf8_char`, and never reads past the current character,
+ *          so buffers need not be '\0' terminated. Nothing is validated, which leaves the minimal decode loop.
+ */
+template<>
+class basic_char_iterator<trusted> {
+public:
+    using iterator_concept = std::bidirectional_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = character;
+    using reference = character;
+    using difference_type = std::ptrdiff_t;
+
+    constexpr basic_char_iterator() noexcept = default;
+    constexpr explicit basic_char_iterator(const char* pos) noexcept : pos_(pos) {}
+
+    /**
+     * @brief The position of the current character in the buffer.
+     */
+    constexpr const char* base() const noexcept { return pos_; }
+
+    constexpr character operator*() const noexcept {
+        return utf8_char { pos_, static_cast<std::uint8_t>(char_byte_len(static_cast<unsigned char>(*pos_))) };
+    }
+
+    constexpr basic_char_iterator& operator++() noexcept {
+        pos_ += char_byte_len(static_cast<unsigned char>(*pos_));
+        return *this;
+    }
+
+    constexpr basic_char_iterator operator++(int) noexcept {
+        basic_char_iterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    constexpr basic_char_iterator& operator--() noexcept {
+        do --pos_; while (!is_char_boundary(static_cast<unsigned char>(*pos_)));
+        return *this;
+    }
+
+    constexpr basic_char_iterator operator--(int) noexcept {
+        basic_char_iterator it = *this;
+        --*this;
+        return it;
+    }
+
+    friend constexpr bool operator==(basic_char_iterator a, basic_char_iterator b) noexcept { return a.pos_ == b.pos_; }
+
+private:
+    const char* pos_ = nullptr;
+};
+
+using char_iterator = basic_char_iterator<trusted>;
+
+/**
+ * @brief The characters of a UTF-8 buffer as a range, validated as `Policy` says.
+ *
+ * @details `chars<trusted>` is a bidirectional range like `string_view`, for bytes the caller knows to be valid.
+ *          `chars<checked>` and `chars<lossy>` are forward ranges over untrusted bytes that validate while iterating,
+ *          so a single pass both validates and decodes.
+ *
+ * @code
+ * // Example usage:
+ * uint32_t sum = 0;
+ * for (utf8::character ch : utf8::chars<utf8::lossy>(untrusted)) sum += ch.code_point();
+ *
+ * auto chars = utf8::chars<utf8::checked>(untrusted);
+ * auto it = chars.begin();
+ * while (it != chars.end()) ++it;
+ * if (it.at_invalid()) printf("invalid at byte %td\n", it.base() - untrusted.data());
+ * @endcode
+ */
+template<typename Policy>
+class chars : public std::ranges::view_interface<chars<Policy>> {
+public:
+    constexpr chars() noexcept = default;
+    constexpr explicit chars(std::string_view bytes) noexcept : str_(bytes.data() ? bytes.data() : ""), byte_len_(bytes.size()) {}
+
+    constexpr const char* data() const noexcept { return str_; }
+    constexpr std::size_t byte_len() const noexcept { return byte_len_; }
+
+    constexpr basic_char_iterator<Policy> begin() const noexcept {
+        if constexpr (std::is_same_v<Policy, trusted>) return basic_char_iterator<Policy>(str_);
+        else return basic_char_iterator<Policy>(str_, str_ + byte_len_);
+    }
+
+    constexpr auto end() const noexcept {
+        if constexpr (std::is_same_v<Policy, trusted>) return basic_char_iterator<Policy>(str_ + byte_len_);
+        else return std::default_sentinel;
+    }
+
+private:
+    const char* str_ = "";
+    std::size_t byte_len_ = 0;
+};
+
+/**
+ * @brief A non-owning view of valid UTF-8 (see `utf8_string`), and a `std::ranges::bidirectional_range` of its characters.
+ *
+ * @details A view can only be made from bytes that were validated, either by `from_bytes` or by the C API
+ *          (`make_utf8_string` and friends). Views are not necessarily '\0' terminated.
+ */
+class string_view : public std::ranges::view_interface<string_view> {
+public:
+    constexpr string_view() noexcept = default;
+
+    /**
+     * @brief Wraps a `utf8_string` of the C API, which is valid by construction. A NULL string gives an empty view.
+     */
+    constexpr string_view(utf8_string ustr) noexcept
+        : str_(ustr.str ? ustr.str : ""), byte_len_(ustr.str ? ustr.byte_len : 0) {}
+
+    /**
+     * @brief Validates `bytes` with `utf8::validate`.
+     *
+     * @return A view of `bytes` if it is valid UTF-8; otherwise `std::nullopt`.
+     */
+    static constexpr std::optional<string_view> from_bytes(std::string_view bytes) noexcept {
+        utf8_validity validity = validate(bytes);
+        if (!validity.valid) return std::nullopt;
+        return from_validated(bytes);
+    }
+
+    /**
+     * @brief Wraps `bytes` without validating them. The caller guarantees they are valid UTF-8.
+     */
+    static constexpr string_view from_validated(std::string_view bytes) noexcept {
+        string_view view;
+        view.str_ = bytes.data() ? bytes.data() : "";
+        view.byte_len_ = bytes.size();
+        return view;
+    }
+
+    constexpr const char* data() const noexcept { return str_; }
+    constexpr std::size_t byte_len() const noexcept { return byte_len_; }
+    constexpr bool empty() const noexcept { return byte_len_ == 0; }
+    constexpr std::string_view bytes() const noexcept { return { str_, byte_len_ }; }
+
+    constexpr char_iterator begin() const noexcept { return char_iterator(str_); }
+    constexpr char_iterator end() const noexcept { return char_iterator(str_ + byte_len_); }
+
+    /**
+     * @brief Counts the characters of the view in O(n) time.
+     */
+    constexpr std::size_t char_count() const noexcept {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < byte_len_; i++)
+            count += is_char_boundary(static_cast<unsigned char>(str_[i]));
+        return count;
+    }
+
+    /**
+     * @brief Same as `slice_utf8_string`: the bytes [byte_index, byte_index + byte_len), clamped to the view.
+     *
+     * @return The slice, or `std::nullopt` if it does not start and end on character boundaries.
+     */
+    constexpr std::optional<string_view> slice(std::size_t byte_index, std::size_t byte_len) const noexcept {
+        if (byte_index > byte_len_) byte_index = byte_len_;
+        std::size_t end = byte_len_ - byte_index < byte_len ? byte_len_ : byte_index + byte_len;
+
+        if (!is_boundary(byte_index) || !is_boundary(end)) return std::nullopt;
+        return from_validated({ str_ + byte_index, end - byte_index });
+    }
+
+    constexpr operator utf8_string() const noexcept { return { str_, byte_len_ }; }
+
+    friend constexpr bool operator==(string_view a, string_view b) noexcept { return a.bytes() == b.bytes(); }
+
+private:
+    constexpr bool is_boundary(std::size_t byte_index) const noexcept {
+        return byte_index == byte_len_ || is_char_boundary(static_cast<unsigned char>(str_[byte_index]));
+    }
+
+    const char* str_ = "";
+    std::size_t byte_len_ = 0;
+};
+
+/**
+ * @brief A valid UTF-8 buffer split into chunks of about `chunk_bytes` bytes, as a random access range of `string_view`s.
+ *
+ * @details Chunk `i` spans from the `i * chunk_bytes`th byte to the `(i + 1) * chunk_bytes`th, both moved forward
+ *          past at most 3 continuation bytes onto a character boundary, so every chunk is valid UTF-8 on its own
+ *          and the chunks cover the buffer exactly once. Chunks are computed when they are dereferenced, in O(1)
+ *          time and without allocating, which makes the range usable with the parallel algorithms of the standard
+ *          library (the iterators are tagged random access, and yield their chunks by value).
+ *
+ * @code
+ * // Example usage:
+ * std::atomic<size_t> count = 0;
+ * std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](utf8::string_view chunk) {
+ *     count += chunk.char_count();
+ * });
+ * @endcode
+ */
+class chunks : public std::ranges::view_interface<chunks> {
+public:
+    class iterator;
+
+    constexpr chunks() noexcept = default;
+
+    /**
+     * @param text The buffer to split.
+     * @param chunk_bytes The approximate byte length of every chunk (a character may push its end up to 3 bytes further).
+     *        Chunks shorter than 4 bytes may be empty.
+     */
+    constexpr chunks(string_view text, std::size_t chunk_bytes) noexcept
+        : text_(text), chunk_bytes_(chunk_bytes ? chunk_bytes : 1) {}
+
+    /**
+     * @brief The number of chunks.
+     */
+    constexpr std::size_t size() const noexcept { return (text_.byte_len() + chunk_bytes_ - 1) / chunk_bytes_; }
+
+    constexpr iterator begin() const noexcept;
+    constexpr iterator end() const noexcept;
+
+    /**
+     * @brief Chunk `index`, for any `index < size()`.
+     */
+    constexpr string_view chunk(std::size_t index) const noexcept {
+        std::size_t start = boundary(index * chunk_bytes_);
+        std::size_t end = boundary((index + 1) * chunk_bytes_);
+        return string_view::from_validated({ text_.data() + start, end - start });
+    }
+
+private:
+    // the first character boundary at or after `byte_index`, at most 3 bytes later
+    constexpr std::size_t boundary(std::size_t byte_index) const noexcept {
+        if (byte_index >= text_.byte_len()) return text_.byte_len();
+        while (byte_index < text_.byte_len() && !is_char_boundary(static_cast<unsigned char>(text_.data()[byte_index]))) byte_index++;
+        return byte_index;
+    }
+
+    string_view text_;
+    std::size_t chunk_bytes_ = 1;
+};
+
+/**
+ * @brief Random access iterator over the chunks of `chunks`, holding a copy of the range so that it outlives it.
+ */
+class chunks::iterator {
+public:
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = string_view;
+    using reference = string_view;
+    using difference_type = std::ptrdiff_t;
+
+    constexpr iterator() noexcept = default;
+    constexpr iterator(chunks range, std::size_t index) noexcept : range_(range), index_(index) {}
+
+    constexpr string_view operator*() const noexcept { return range_.chunk(index_); }
+    constexpr string_view operator[](difference_type n) const noexcept { return range_.chunk(index_ + n); }
+
+    constexpr iterator& operator++() noexcept { index_++; return *this; }
+    constexpr iterator& operator--() noexcept { index_--; return *this; }
+    constexpr iterator operator++(int) noexcept { iterator it = *this; index_++; return it; }
+    constexpr iterator operator--(int) noexcept { iterator it = *this; index_--; return it; }
+
+    constexpr iterator& operator+=(difference_type n) noexcept { index_ += n; return *this; }
+    constexpr iterator& operator-=(difference_type n) noexcept { index_ -= n; return *this; }
+
+    friend constexpr iterator operator+(iterator it, difference_type n) noexcept { return it += n; }
+    friend constexpr iterator operator+(difference_type n, iterator it) noexcept { return it += n; }
+    friend constexpr iterator operator-(iterator it, difference_type n) noexcept { return it -= n; }
+    friend constexpr difference_type operator-(const iterator& a, const iterator& b) noexcept {
+        return static_cast<difference_type>(a.index_) - static_cast<difference_type>(b.index_);
+    }
+
+    friend constexpr bool operator==(const iterator& a, const iterator& b) noexcept { return a.index_ == b.index_; }
+    friend constexpr std::strong_ordering operator<=>(const iterator& a, const iterator& b) noexcept { return a.index_ <=> b.index_; }
+
+private:
+    chunks range_;
+    std::size_t index_ = 0;
+};
+
+constexpr chunks::iterator chunks::begin() const noexcept { return iterator(*this, 0); }
+constexpr chunks::iterator chunks::end() const noexcept { return iterator(*this, size()); }
+
+namespace detail {
+
+// Not constexpr: calling it while validating a `utf8::literal` turns invalid UTF-8 into a compile error that names it.
+inline void invalid_utf8_literal() noexcept {}
+
+} // namespace detail
+
+/**
+ * @brief A string literal validated at compile time, made with the `_u8s` literal operator.
+ *
+ * @details Holds the literal's byte length and character count, both computed at compile time, so using
+ *          a literal costs neither validation nor counting at run time. Literals made by `_u8s` are '\0' terminated
+ *          and live as long as the program.
+ */
+class literal {
+public:
+    /**
+     * @brief Validates and counts `bytes` at compile time. Bytes that are not valid UTF-8 do not compile.
+     */
+    consteval literal(std::string_view bytes) : view_(string_view::from_validated(bytes)) {
+        if (!detail::validate_bytes(bytes).valid) detail::invalid_utf8_literal();
+        char_count_ = view_.char_count();
+    }
+
+    constexpr const char* data() const noexcept { return view_.data(); }
+    constexpr const char* c_str() const noexcept { return view_.data(); }
+    constexpr std::size_t byte_len() const noexcept { return view_.byte_len(); }
+    constexpr std::size_t char_count() const noexcept { return char_count_; }
+    constexpr bool empty() const noexcept { return view_.empty(); }
+
+    constexpr string_view view() const noexcept { return view_; }
+    constexpr operator string_view() const noexcept { return view_; }
+    constexpr operator utf8_string() const noexcept { return view_; }
+
+    constexpr char_iterator begin() const noexcept { return view_.begin(); }
+    constexpr char_iterator end() const noexcept { return view_.end(); }
+
+private:
+    string_view view_;
+    std::size_t char_count_ = 0;
+};
+
+inline namespace literals {
+
+/**
+ * @brief Validates a string literal at compile time: `"こんにちは"_u8s` is a `utf8::literal`,
+ *        and a literal that is not valid UTF-8 does not compile.
+ *
+ * @details Embedded '\0' characters are part of the literal, like in `string_view::from_bytes`.
+ *
+ * @code
+ * using namespace utf8::literals;
+ *
+ * constexpr utf8::literal greeting = "Здравствуйте"_u8s;
+ * static_assert(greeting.char_count() == 12);
+ * utf8_string ustr = greeting;    // no make_utf8_string at startup
+ * @endcode
+ */
+consteval literal operator""_u8s(const char* str, std::size_t byte_len) {
+    return literal(std::string_view(str, byte_len));
+}
+
+} // namespace literals
+
+/**
+ * @brief An owned, '\0' terminated, valid UTF-8 string (see `owned_utf8_string`).
+ *
+ * @details Move-only: the buffer is never copied implicitly, `clone` is the only way to duplicate it.
+ *          The buffer is allocated by the C API (or with `malloc`) and freed with `free_owned_utf8_string`.
+ */
+class string {
+public:
+    string() noexcept = default;
+
+    /**
+     * @brief Takes ownership of an `owned_utf8_string`, e.g. the result of `make_utf8_string_lossy`.
+     */
+    explicit string(owned_utf8_string owned) noexcept : owned_(owned) {}
+
+    string(const string&) = delete;
+    string& operator=(const string&) = delete;
+
+    string(string&& other) noexcept : owned_(std::exchange(other.owned_, owned_utf8_string { nullptr, 0 })) {}
+
+    string& operator=(string&& other) noexcept {
+        if (this != &other) {
+            free_owned_utf8_string(&owned_);
+            owned_ = std::exchange(other.owned_, owned_utf8_string { nullptr, 0 });
+        }
+        return *this;
+    }
+
+    ~string() { free_owned_utf8_string(&owned_); }
+
+    /**
+     * @brief Same as `make_utf8_string_lossy`: copies `str`, replacing invalid sequences with U+FFFD.
+     *
+     * @throws std::bad_alloc if the buffer could not be allocated.
+     */
+    static string lossy(const char* str) {
+        owned_utf8_string owned = make_utf8_string_lossy(str);
+        if (owned.str == nullptr && str != nullptr) throw std::bad_alloc();
+        return string(owned);
+    }
+
+    /**
+     * @brief Copies the bytes of a view into a new string.
+     *
+     * @throws std::bad_alloc if the buffer could not be allocated.
+     */
+    static string copy_of(string_view view) {
+        char* buffer = static_cast<char*>(std::malloc(view.byte_len() + 1));
+        if (buffer == nullptr) throw std::bad_alloc();
+
+        std::memcpy(buffer, view.data(), view.byte_len());
+        buffer[view.byte_len()] = '\0';
+        return string(owned_utf8_string { buffer, view.byte_len() });
+    }
+
+    /**
+     * @brief Explicit copy of the string.
+     *
+     * @throws std::bad_alloc if the buffer could not be allocated.
+     */
+    string clone() const { return copy_of(view()); }
+
+    /**
+     * @brief Gives up ownership of the buffer, which the caller then frees with `free_owned_utf8_string`.
+     */
+    owned_utf8_string release() noexcept { return std::exchange(owned_, owned_utf8_string { nullptr, 0 }); }
+
+    string_view view() const noexcept { return as_utf8_string(&owned_); }
+    operator string_view() const noexcept { return view(); }
+
+    const char* data() const noexcept { return owned_.str ? owned_.str : ""; }
+    const char* c_str() const noexcept { return data(); }
+    std::size_t byte_len() const noexcept { return owned_.byte_len; }
+    bool empty() const noexcept { return owned_.byte_len == 0; }
+
+    char_iterator begin() const noexcept { return view().begin(); }
+    char_iterator end() const noexcept { return view().end(); }
+
+private:
+    owned_utf8_string owned_ = { nullptr, 0 };
+};
+
+/**
+ * @brief A coroutine that yields values of type `T` one at a time, and the input range of those values.
+ *
+ * @details The coroutine starts when iteration begins and runs up to its next `co_yield` every time the iterator
+ *          is advanced. Move-only; destroying the generator destroys a suspended coroutine.
+ */
+template<typename T>
+class generator {
+public:
+    struct promise_type {
+        T value {};
+        std::exception_ptr exception;
+
+        generator get_return_object() noexcept { return generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(T yielded) noexcept {
+            value = yielded;
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+    };
+
+    class iterator {
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() noexcept = default;
+        explicit iterator(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine_(coroutine) {}
+
+        const T& operator*() const noexcept { return coroutine_.promise().value; }
+
+        iterator& operator++() {
+            resume(coroutine_);
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept { return it.coroutine_.done(); }
+
+    private:
+        std::coroutine_handle<promise_type> coroutine_;
+    };
+
+    generator(generator&& other) noexcept : coroutine_(std::exchange(other.coroutine_, nullptr)) {}
+
+    generator& operator=(generator&& other) noexcept {
+        if (this != &other) {
+            if (coroutine_) coroutine_.destroy();
+            coroutine_ = std::exchange(other.coroutine_, nullptr);
+        }
+        return *this;
+    }
+
+    ~generator() {
+        if (coroutine_) coroutine_.destroy();
+    }
+
+    /**
+     * @brief Runs the coroutine up to its first value. Can only be called once.
+     */
+    iterator begin() {
+        resume(coroutine_);
+        return iterator(coroutine_);
+    }
+
+    std::default_sentinel_t end() const noexcept { return std::default_sentinel; }
+
+private:
+    explicit generator(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine_(coroutine) {}
+
+    // resumes the coroutine and rethrows what escaped from it
+    static void resume(std::coroutine_handle<promise_type> coroutine) {
+        coroutine.resume();
+        if (coroutine.promise().exception) std::rethrow_exception(std::exchange(coroutine.promise().exception, nullptr));
+    }
+
+    std::coroutine_handle<promise_type> coroutine_;
+};
+
+/**
+ * @brief Decodes UTF-8 that arrives in chunks, e.g. from a socket, yielding the validated text of every chunk.
+ *
+ * @details Built on `utf8_validator`. A character split across chunks is completed in a 4 byte buffer of the decoder,
+ *          and everything else is yielded as slices of the chunks themselves, so at most 3 bytes are ever copied
+ *          per chunk. Once an invalid sequence is found, nothing more is yielded and `validity` tells where it is.
+ *
+ *          `feed` is a synchronous generator, so it can be iterated between the `co_await`s of an asynchronous coroutine:
+ *
+ * @code
+ * utf8::stream_decoder decoder;
+ * while (size_t n = co_await socket.read(buffer)) {
+ *     for (utf8::string_view text : decoder.feed({ buffer, n }))
+ *         co_await forward(text);
+ * }
+ * if (!decoder.finish().valid) co_return reject(decoder.validity().valid_upto);
+ * @endcode
+ */
+class stream_decoder {
+public:
+    stream_decoder() noexcept : validator_(make_utf8_validator()) {}
+
+    /**
+     * @brief Validates the next chunk of the stream and yields its text that became valid.
+     *
+     * @details The first view yielded may be a character completed from the end of the previous chunk,
+     *          the next one is a slice of `chunk` up to its last complete character. Views stay valid as long as
+     *          `chunk` does, and until the decoder is fed again. The chunk is validated by the call itself, so
+     *          `validity` and `finish` account for it even if the generator is never iterated.
+     */
+    generator<string_view> feed(std::string_view chunk) {
+        char previous[4];
+        std::size_t previous_len = validator_.pending_len;
+        std::memcpy(previous, validator_.pending, previous_len);
+
+        std::size_t valid_before = validator_.validity.valid_upto;
+        std::size_t valid_len = feed_utf8_validator(&validator_, chunk.data(), chunk.size()).valid_upto - valid_before;
+
+        std::string_view completed;
+        std::size_t offset = 0;
+        if (previous_len > 0 && valid_len > 0) {
+            // the character cut by the end of the previous chunk was completed by the start of this one
+            std::size_t char_len = char_byte_len(static_cast<unsigned char>(previous[0]));
+            offset = char_len - previous_len;
+            std::memcpy(split_char_, previous, previous_len);
+            std::memcpy(split_char_ + previous_len, chunk.data(), offset);
+            completed = { split_char_, char_len };
+            valid_len -= char_len;
+        }
+
+        return yield_validated(completed, chunk.substr(offset, valid_len));
+    }
+
+    /**
+     * @brief Same as `feed`, yielding the code points of the characters instead.
+     */
+    generator<std::uint32_t> feed_code_points(std::string_view chunk) { return yield_code_points(feed(chunk)); }
+
+    /**
+     * @brief Validity of the stream so far; `valid_upto` counts the bytes yielded.
+     */
+    utf8_validity validity() const noexcept { return validator_.validity; }
+
+    /**
+     * @brief Ends the stream, see `finish_utf8_validator`: a character still waiting for its remaining bytes makes it invalid.
+     */
+    utf8_validity finish() noexcept { return finish_utf8_validator(&validator_); }
+
+private:
+    // yields the views that are not empty, already validated by `feed`
+    static generator<string_view> yield_validated(std::string_view first, std::string_view second) {
+        if (!first.empty()) co_yield string_view::from_validated(first);
+        if (!second.empty()) co_yield string_view::from_validated(second);
+    }
+
+    static generator<std::uint32_t> yield_code_points(generator<string_view> texts) {
+        for (string_view text : texts)
+            for (character ch : text) co_yield ch.code_point();
+    }
+
+    utf8_validator validator_;
+    char split_char_[4] = { 0 };
+};
+
+} // namespace utf8
+
+template<>
+inline constexpr bool std::ranges::enable_borrowed_range<utf8::string_view> = true;
+
+template<typename Policy>
+inline constexpr bool std::ranges::enable_borrowed_range<utf8::chars<Policy>> = true;
+
+template<>
+inline constexpr bool std::ranges::enable_borrowed_range<utf8::chunks> = true;
+
+#endif
@@ -0,0 +1,97 @@
+#include "utf8_compact.h"
+#include "utf8_swar.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Code points up to U+00FF have lead bytes up to 0xC3, those up to U+FFFF lead bytes up to 0xEF.
+static uint8_t width_of_leads(bool above_latin1, bool above_bmp) {
+    if (above_bmp) return 4;
+    if (above_latin1) return 2;
+    return 1;
+}
+
+utf8_compact_string make_utf8_compact_string(utf8_string ustr) {
+    utf8_compact_string cs = { .data = NULL, .length = 0, .width = 1 };
+    if (ustr.str == NULL) return cs;
+
+    const char* str = ustr.str;
+    size_t byte_len = ustr.byte_len;
+
+    // first pass: count the characters and find the widest lead byte
+    uint64_t above_latin1 = 0, above_bmp = 0;
+    size_t offset = 0;
+    for (; byte_len - offset >= 8; offset += 8) {
+        uint64_t word = load_word(str + offset);
+        cs.length += count_char_starts_in_word(word);
+        above_latin1 |= bytes_at_least(word, 0xC4);
+        above_bmp |= bytes_at_least(word, 0xF0);
+    }
+    for (; offset < byte_len; offset++) {
+        uint8_t byte = (uint8_t)str[offset];
+        cs.length += is_char_start(byte);
+        above_latin1 |= byte >= 0xC4;
+        above_bmp |= byte >= 0xF0;
+    }
+    cs.width = width_of_leads(above_latin1 != 0, above_bmp != 0);
+
+    // at least 1 byte, so that NULL only means that memory ran out
+    cs.data = malloc(cs.length * cs.width + 1);
+    if (!cs.data) {
+        cs.length = 0;
+        return cs;
+    }
+
+    // second pass: decode, copying runs of ASCII 8 bytes at a time into 1 byte strings
+    offset = 0;
+    for (size_t i = 0; i < cs.length; i++) {
+        if (cs.width == 1) {
+            while (byte_len - offset >= 8 && (load_word(str + offset) & HIGH_BITS) == 0) {
+                memcpy((uint8_t*)cs.data + i, str + offset, 8);
+                i += 8;
+                offset += 8;
+            }
+            if (i == cs.length) break;
+        }
+
+        utf8_char ch = { .str = str + offset, .byte_len = utf8_lead_byte_len((uint8_t)str[offset]) };
+        uint32_t code_point = unicode_code_point(ch);
+        offset += ch.byte_len;
+
+        switch (cs.width) {
+        case 1: ((uint8_t*)cs.data)[i] = (uint8_t)code_point; break;
+        case 2: ((uint16_t*)cs.data)[i] = (uint16_t)code_point; break;
+        case 4: ((uint32_t*)cs.data)[i] = code_point; break;
+        }
+    }
+
+    return cs;
+}
+
+void free_utf8_compact_string(utf8_compact_string* cs) {
+    free(cs->data);
+    cs->data = NULL;
+    cs->length = 0;
+}
+
+uint32_t compact_code_point_at(const utf8_compact_string* cs, size_t index) {
+    switch (cs->width) {
+    case 1: return ((const uint8_t*)cs->data)[index];
+    case 2: return ((const uint16_t*)cs->data)[index];
+    default: return ((const uint32_t*)cs->data)[index];
+    }
+}
+
+owned_utf8_string make_utf8_string_from_compact(const utf8_compact_string* cs) {
+    size_t byte_len = 0;
+    for (size_t i = 0; i < cs->length; i++) byte_len += utf8_len_of(compact_code_point_at(cs, i));
+
+    char* str = malloc(byte_len + 1);
+    if (!str) return (owned_utf8_string) { .str = NULL, .byte_len = 0 };
+
+    size_t offset = 0;
+    for (size_t i = 0; i < cs->length; i++) offset += put_utf8(str + offset, compact_code_point_at(cs, i));
+    str[byte_len] = '\0';
+
+    return (owned_utf8_string) { .str = str, .byte_len = byte_len };
+}
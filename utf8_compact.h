@@ -0,0 +1,67 @@
+/**
+ * @file utf8_compact.h
+ * @brief fixed width strings of code points with O(1) indexing, in the narrowest width that fits (like PEP 393)
+ *
+ * @code
+ * #include "utf8_compact.h"
+ *
+ * utf8_compact_string cs = make_utf8_compact_string(make_utf8_string("Grüße"));   // 1 byte per character
+ * uint32_t code_point = compact_code_point_at(&cs, 2);                            // U+00FC ü
+ * owned_utf8_string str = make_utf8_string_from_compact(&cs);                     // back to "Grüße"
+ * free_owned_utf8_string(&str);
+ * free_utf8_compact_string(&cs);
+ * @endcode
+ */
+
+#ifndef ZAHASH_UTF8_COMPACT_H
+#define ZAHASH_UTF8_COMPACT_H
+
+#include "utf8.h"
+
+/**
+ * @brief The code points of a string, all stored with the same width so that any of them is found in O(1) time.
+ *
+ * @details The width is the narrowest that fits every code point of the string: 1 byte if they are all at most
+ *          U+00FF (Latin-1, ASCII included), 2 bytes if they are all in the Basic Multilingual Plane (at most U+FFFF)
+ *          and 4 bytes (UTF-32) otherwise. Most text takes no more memory than in UTF-8, or less, instead of the
+ *          4 bytes per character of converting everything to UTF-32.
+ */
+typedef struct {
+    void* data;         ///< `length` code points of `width` bytes each (`uint8_t`, `uint16_t` or `uint32_t`).
+    size_t length;      ///< Number of code points.
+    uint8_t width;      ///< Bytes per code point: 1, 2 or 4.
+} utf8_compact_string;
+
+/**
+ * @brief Converts a valid UTF-8 string to its compact representation in O(n) time.
+ *
+ * @details A first pass finds the width from the lead bytes and counts the characters, 8 bytes at a time,
+ *          a second pass decodes the characters into an array of exactly the right size.
+ *          The string is bounded by `ustr.byte_len` only: '\0' bytes are characters like any other.
+ *
+ * @param ustr The UTF-8 string.
+ * @return The compact string, with NULL `data` if memory ran out (or `ustr` is { NULL, 0 }).
+ *         The caller is responsible for freeing it with `free_utf8_compact_string`.
+ */
+utf8_compact_string make_utf8_compact_string(utf8_string ustr);
+
+/**
+ * @brief Frees the memory of a compact string.
+ */
+void free_utf8_compact_string(utf8_compact_string* cs);
+
+/**
+ * @brief The code point at character index `index` in O(1) time. The index must be less than `cs->length`.
+ */
+uint32_t compact_code_point_at(const utf8_compact_string* cs, size_t index);
+
+/**
+ * @brief Converts a compact string back to UTF-8 in O(n) time.
+ *
+ * @param cs The compact string.
+ * @return The UTF-8 string ('\0' terminated), or { NULL, 0 } if memory ran out.
+ *         The caller is responsible for freeing it with `free_owned_utf8_string`.
+ */
+owned_utf8_string make_utf8_string_from_compact(const utf8_compact_string* cs);
+
+#endif
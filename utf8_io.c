@@ -0,0 +1,732 @@
+#include "utf8_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <time.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+// Regular files are mapped this much at a time, so even huge files only take this much address space.
+#define MAP_WINDOW (64 << 20)
+
+// Block size for files that cannot be mapped.
+#define READ_BLOCK (1 << 20)
+
+// Receives the file contents chunk by chunk. `chunk` starts at byte `offset` of the input.
+// Sets `*consumed` to the number of bytes it is done with; the rest (an incomplete trailing character)
+// is handed back at the start of the next chunk. Returns false to stop reading.
+typedef bool (*chunk_fn)(void* ctx, const char* chunk, size_t len, size_t offset, bool final, size_t* consumed);
+
+static int read_chunks(int fd, chunk_fn fn, void* ctx, size_t* bytes_read) {
+    // room for up to 3 carried bytes in front of every block
+    char* buffer = malloc(READ_BLOCK + 4);
+    if (!buffer) return ENOMEM;
+
+    size_t carried = 0;
+    size_t offset = 0;  // input offset of buffer[0]
+    int error = 0;
+
+    while (1) {
+        ssize_t n = read(fd, buffer + carried, READ_BLOCK);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error = errno;
+            break;
+        }
+
+        size_t len = carried + (size_t)n;
+        bool final = n == 0;
+        *bytes_read = offset + len;
+
+        size_t consumed = len;
+        if (!fn(ctx, buffer, len, offset, final, &consumed) || final) break;
+
+        carried = len - consumed;
+        memmove(buffer, buffer + consumed, carried);
+        offset += consumed;
+    }
+
+    free(buffer);
+    return error;
+}
+
+// Maps the rest of a regular file window by window. Returns -1 if the file cannot be mapped at all.
+static int map_chunks(int fd, off_t start, off_t size, chunk_fn fn, void* ctx, size_t* bytes_read) {
+    off_t page = (off_t)sysconf(_SC_PAGESIZE);
+    off_t pos = start;
+
+    while (1) {
+        // mmap offsets must be page aligned, the window starts a little before `pos`
+        off_t map_start = pos - pos % page;
+        size_t skip = (size_t)(pos - map_start);
+        size_t map_len = size - map_start > (off_t)(MAP_WINDOW + skip) ? MAP_WINDOW + skip : (size_t)(size - map_start);
+
+        char* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_start);
+        if (map == MAP_FAILED) {
+            if (pos == start) return -1;
+            return errno;
+        }
+
+        madvise(map, map_len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        madvise(map, map_len, MADV_HUGEPAGE); // only honoured where the page cache supports huge pages
+#endif
+
+        size_t len = map_len - skip;
+        bool final = map_start + (off_t)map_len == size;
+        *bytes_read = (size_t)(pos - start) + len;
+
+        size_t consumed = len;
+        bool more = fn(ctx, map + skip, len, (size_t)(pos - start), final, &consumed);
+        munmap(map, map_len);
+
+        pos += (off_t)consumed;
+        if (!more || final) break;
+    }
+
+    lseek(fd, pos, SEEK_SET);
+    return 0;
+}
+
+// Feeds the file from its current position to the end to `fn`, mapping it when possible.
+static int for_each_chunk(int fd, chunk_fn fn, void* ctx, size_t* bytes_read) {
+    *bytes_read = 0;
+
+    struct stat st;
+    off_t start;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (start = lseek(fd, 0, SEEK_CUR)) >= 0) {
+        if (st.st_size <= start) {
+            size_t consumed;
+            fn(ctx, "", 0, 0, true, &consumed);
+            return 0;
+        }
+
+        int error = map_chunks(fd, start, st.st_size, fn, ctx, bytes_read);
+        if (error >= 0) return error;
+    }
+
+    return read_chunks(fd, fn, ctx, bytes_read);
+}
+
+static int open_file(const char* path, int* fd) {
+    do *fd = open(path, O_RDONLY);
+    while (*fd < 0 && errno == EINTR);
+    return *fd < 0 ? errno : 0;
+}
+
+static bool validate_chunk(void* ctx, const char* chunk, size_t len, size_t offset, bool final, size_t* consumed) {
+    (void)offset;
+    utf8_validator* validator = ctx;
+
+    // the validator keeps incomplete characters itself
+    *consumed = len;
+    feed_utf8_validator(validator, chunk, len);
+    if (final) finish_utf8_validator(validator);
+
+    return validator->validity.valid;
+}
+
+utf8_file_validity validate_utf8_fd(int fd) {
+    utf8_validator validator = make_utf8_validator();
+    size_t bytes_read;
+
+    int error = for_each_chunk(fd, validate_chunk, &validator, &bytes_read);
+    if (error) validator.validity.valid = false;
+
+    return (utf8_file_validity) { .validity = validator.validity, .byte_len = bytes_read, .error = error };
+}
+
+utf8_file_validity validate_utf8_file(const char* path) {
+    int fd;
+    int error = open_file(path, &fd);
+    if (error) return (utf8_file_validity) { .validity = { .valid = false, .valid_upto = 0 }, .byte_len = 0, .error = error };
+
+    utf8_file_validity result = validate_utf8_fd(fd);
+    close(fd);
+    return result;
+}
+
+static bool scan_chunk(void* ctx, const char* chunk, size_t len, size_t offset, bool final, size_t* consumed) {
+    utf8_text_stats* total = ctx;
+    utf8_text_stats stats = scan_utf8_text(chunk, len);
+
+    total->char_count += stats.char_count;
+    total->line_count += stats.line_count;
+    total->is_ascii = total->is_ascii && stats.is_ascii;
+    if (stats.max_char_len > total->max_char_len) total->max_char_len = stats.max_char_len;
+    total->validity.valid_upto = offset + stats.validity.valid_upto;
+    *consumed = stats.validity.valid_upto;
+
+    if (stats.validity.valid) return true;
+
+    // a character cut by the end of the chunk is scanned again at the start of the next one
+    if (!final && utf8_incomplete_suffix_len(chunk, len) == len - stats.validity.valid_upto) return true;
+
+    total->validity.valid = false;
+    return false;
+}
+
+utf8_file_stats scan_utf8_fd(int fd) {
+    utf8_text_stats stats = { .validity = { .valid = true, .valid_upto = 0 }, .is_ascii = true };
+    size_t bytes_read;
+
+    int error = for_each_chunk(fd, scan_chunk, &stats, &bytes_read);
+    if (error) stats.validity.valid = false;
+
+    return (utf8_file_stats) { .stats = stats, .byte_len = bytes_read, .error = error };
+}
+
+utf8_file_stats scan_utf8_file(const char* path) {
+    int fd;
+    int error = open_file(path, &fd);
+    if (error) {
+        utf8_text_stats stats = { .validity = { .valid = false, .valid_upto = 0 } };
+        return (utf8_file_stats) { .stats = stats, .byte_len = 0, .error = error };
+    }
+
+    utf8_file_stats result = scan_utf8_fd(fd);
+    close(fd);
+    return result;
+}
+
+// Writes all of `iov`, resuming after partial writes. `iov` is modified.
+static int write_all(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+
+        // skip what has been written
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+// Vectors per writev call. POSIX guarantees at least 16 (_XOPEN_IOV_MAX), Linux allows 1024.
+#define SANITIZE_IOV_MAX 64
+
+typedef struct {
+    int out_fd;
+    utf8_sanitize_result* result;
+    struct iovec iov[SANITIZE_IOV_MAX];
+    int iovcnt;
+} sanitize_ctx;
+
+static bool push_region(sanitize_ctx* ctx, const char* str, size_t len) {
+    if (len == 0) return true;
+
+    if (ctx->iovcnt == SANITIZE_IOV_MAX) {
+        ctx->result->error = write_all(ctx->out_fd, ctx->iov, ctx->iovcnt);
+        ctx->iovcnt = 0;
+        if (ctx->result->error) return false;
+    }
+
+    ctx->iov[ctx->iovcnt++] = (struct iovec) { .iov_base = (void*)str, .iov_len = len };
+    ctx->result->bytes_written += len;
+    return true;
+}
+
+static bool sanitize_chunk(void* arg, const char* chunk, size_t len, size_t offset, bool final, size_t* consumed) {
+    (void)offset;
+    sanitize_ctx* ctx = arg;
+    size_t done = 0;
+
+    while (done < len) {
+        utf8_validity validity = validate_utf8_n(chunk + done, len - done);
+        if (!push_region(ctx, chunk + done, validity.valid_upto)) return false;
+        done += validity.valid_upto;
+        if (validity.valid) break;
+
+        // a character cut by the end of the block is completed by the next one
+        if (!final && utf8_incomplete_suffix_len(chunk, len) == len - done) break;
+
+        // EF BF BD == U+FFFD, shared by all replacements
+        if (!push_region(ctx, "\xEF\xBF\xBD", 3)) return false;
+        ctx->result->replacements++;
+        done++;
+    }
+
+    // the regions point into the read buffer, so they are written before it is reused
+    ctx->result->error = write_all(ctx->out_fd, ctx->iov, ctx->iovcnt);
+    ctx->iovcnt = 0;
+
+    *consumed = done;
+    return ctx->result->error == 0;
+}
+
+utf8_sanitize_result sanitize_utf8_fd(int in_fd, int out_fd) {
+    utf8_sanitize_result result = { 0 };
+    sanitize_ctx ctx = { .out_fd = out_fd, .result = &result, .iovcnt = 0 };
+
+    int error = read_chunks(in_fd, sanitize_chunk, &ctx, &result.bytes_read);
+    if (error) result.error = error;
+
+    return result;
+}
+
+utf8_bulk_config default_utf8_bulk_config(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (utf8_bulk_config) { .queue_depth = 64, .block_size = 256 << 10, .threads = cpus > 0 ? (size_t)cpus : 1 };
+}
+
+typedef struct {
+    const char* const* paths;
+    size_t n;
+    utf8_file_validity* results;
+    pthread_mutex_t lock;
+    size_t next_file;  // index of the next file to open, guarded by `lock`
+} bulk_files;
+
+// Returns the index of the next file to validate, or `n` when there is none left.
+static size_t take_file(bulk_files* files) {
+    pthread_mutex_lock(&files->lock);
+    size_t file = files->next_file;
+    if (file < files->n) files->next_file++;
+    pthread_mutex_unlock(&files->lock);
+    return file;
+}
+
+typedef struct {
+    void (*fn)(void* arg);
+    void* arg;
+} bulk_thread;
+
+static void* bulk_thread_main(void* arg) {
+    bulk_thread* thread = arg;
+    thread->fn(thread->arg);
+    return NULL;
+}
+
+// Runs `fn(arg)` on `threads` threads, the calling thread being one of them, and waits for all of them.
+// The bulk workers block on reads or on completions, so they get threads of their own: as tasks of the shared
+// `utf8_pool` they would hold its threads and stall the parallel operations of other threads meanwhile.
+// Each worker takes files until there are none left, so fewer threads (if creating one fails) only take longer.
+static void run_bulk_threads(void (*fn)(void* arg), void* arg, size_t threads) {
+    bulk_thread thread = { .fn = fn, .arg = arg };
+    pthread_t* ids = threads > 1 ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+
+    size_t started = 0;
+    while (ids && started < threads - 1 && pthread_create(&ids[started], NULL, bulk_thread_main, &thread) == 0) started++;
+
+    fn(arg);
+    for (size_t i = 0; i < started; i++) pthread_join(ids[i], NULL);
+    free(ids);
+}
+
+static void validate_files_blocking(void* arg) {
+    bulk_files* files = arg;
+    for (size_t file; (file = take_file(files)) < files->n;)
+        files->results[file] = validate_utf8_file(files->paths[file]);
+}
+
+#ifdef HAVE_IO_URING
+
+// The ring is driven with raw system calls so that liburing is not required.
+typedef struct {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_len;
+    void* cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+    pthread_mutex_t submit_lock;  // the workers share the submission queue
+} uring;
+
+static int io_uring_enter_retry(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    long ret;
+    do ret = syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+    while (ret < 0 && errno == EINTR);
+    return ret < 0 ? errno : 0;
+}
+
+static void close_uring(uring* ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_len);
+    close(ring->fd);
+    pthread_mutex_destroy(&ring->submit_lock);
+}
+
+// Returns false if io_uring is not available or lacks IORING_OP_READ (before Linux 5.6).
+static bool open_uring(uring* ring, unsigned entries) {
+    *ring = (uring) { .fd = -1 };
+
+    struct io_uring_params params = { 0 };
+    long fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) return false;
+    ring->fd = (int)fd;
+    pthread_mutex_init(&ring->submit_lock, NULL);
+
+    // IORING_OP_READ arrived together with this feature
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close_uring(ring);
+        return false;
+    }
+
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map && ring->cq_map_len > ring->sq_map_len) ring->sq_map_len = ring->cq_map_len;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) ring->sq_map = NULL;
+    ring->cq_map = single_map ? ring->sq_map
+        : mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) ring->cq_map = NULL;
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+
+    if (!ring->sq_map || !ring->cq_map || !ring->sqes) {
+        close_uring(ring);
+        return false;
+    }
+
+    char* sq = ring->sq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = ring->cq_map;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Submits a single request. The submission queue never fills up: every entry is consumed by the kernel
+// before `io_uring_enter` returns and there are never more requests in flight than completion queue entries.
+// If `io_uring_enter` fails without consuming the entry, the entry is taken back, so that a later call does not
+// submit it with a file descriptor and a buffer that are no longer the request's. If the kernel consumed it,
+// the request is submitted whatever `io_uring_enter` returned, and its completion comes like any other.
+static int submit_uring(uring* ring, uint8_t opcode, int fd, void* buffer, unsigned len, uint64_t offset, uint64_t user_data) {
+    pthread_mutex_lock(&ring->submit_lock);
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int error = io_uring_enter_retry(ring->fd, 1, 0, 0);
+    if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) != tail) error = 0;
+    else {
+        // only `io_uring_enter` consumes entries, and the lock keeps other submissions out
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        if (!error) error = EBUSY;
+    }
+    pthread_mutex_unlock(&ring->submit_lock);
+    return error;
+}
+
+typedef struct {
+    size_t file;
+    int fd;
+    uint64_t offset;  // bytes read so far
+    int res;          // result of the completed read
+    char* buffer;
+    utf8_validator validator;
+} bulk_slot;
+
+typedef struct {
+    bulk_files* files;
+    uring ring;
+    int wake_fd;          // eventfd that wakes the reaper when the last file is done
+    size_t block_size;
+    bulk_slot* slots;
+    size_t depth;         // number of slots
+
+    pthread_mutex_t lock;
+    pthread_cond_t completed;
+    size_t* queue;        // completed slots waiting for a worker, a ring buffer of one entry per slot
+    size_t queue_head;
+    size_t queue_len;
+    size_t files_done;
+    size_t in_flight;     // reads submitted whose completion has not been reaped, the buffers are in use until then
+    int failed;           // errno of a failed wait for completions, after which no reads are submitted anymore
+    bool stop;
+} bulk_job;
+
+static int submit_read(bulk_job* job, bulk_slot* slot) {
+    // counted before the submission, so the reaper never sees no reads in flight while one is being submitted
+    pthread_mutex_lock(&job->lock);
+    int error = job->failed;
+    if (!error) job->in_flight++;
+    pthread_mutex_unlock(&job->lock);
+    if (error) return error;
+
+    error = submit_uring(&job->ring, IORING_OP_READ, slot->fd, slot->buffer, (unsigned)job->block_size, slot->offset, slot - job->slots);
+    if (error) {
+        pthread_mutex_lock(&job->lock);
+        job->in_flight--;
+        pthread_mutex_unlock(&job->lock);
+    }
+    return error;
+}
+
+static void file_done(bulk_job* job, size_t file, utf8_file_validity result) {
+    job->files->results[file] = result;
+
+    pthread_mutex_lock(&job->lock);
+    bool all_done = ++job->files_done == job->files->n;
+    pthread_mutex_unlock(&job->lock);
+
+    // the reaper may be waiting for completions, and there are none left
+    if (all_done) {
+        uint64_t one = 1;
+        while (write(job->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    }
+}
+
+static void fail_file(bulk_job* job, size_t file, size_t byte_len, int error) {
+    utf8_file_validity result = { .validity = { .valid = false, .valid_upto = 0 }, .byte_len = byte_len, .error = error };
+    file_done(job, file, result);
+}
+
+// Opens the next file into `slot` and submits its first read. The slot stays idle when there are no files left.
+static void start_next_file(bulk_job* job, bulk_slot* slot) {
+    for (size_t file; (file = take_file(job->files)) < job->files->n;) {
+        int error = open_file(job->files->paths[file], &slot->fd);
+        if (error) {
+            fail_file(job, file, 0, error);
+            continue;
+        }
+
+        slot->file = file;
+        slot->offset = 0;
+        slot->validator = make_utf8_validator();
+        error = submit_read(job, slot);
+        if (!error) return;
+
+        close(slot->fd);
+        fail_file(job, file, 0, error);
+    }
+}
+
+static void finish_file(bulk_job* job, bulk_slot* slot, int error) {
+    close(slot->fd);
+    if (error) fail_file(job, slot->file, slot->offset, error);
+    else file_done(job, slot->file, (utf8_file_validity) { .validity = slot->validator.validity, .byte_len = slot->offset, .error = 0 });
+    start_next_file(job, slot);
+}
+
+// Handles a completed read: validates the block and reads on, or finishes the file.
+static void process_slot(bulk_job* job, bulk_slot* slot) {
+    if (slot->res == -EINTR || slot->res == -EAGAIN) {
+        int error = submit_read(job, slot);
+        if (error) finish_file(job, slot, error);
+        return;
+    }
+    if (slot->res < 0) {
+        finish_file(job, slot, -slot->res);
+        return;
+    }
+    if (slot->res == 0) {
+        finish_utf8_validator(&slot->validator);
+        finish_file(job, slot, 0);
+        return;
+    }
+
+    feed_utf8_validator(&slot->validator, slot->buffer, (size_t)slot->res);
+    slot->offset += (uint64_t)slot->res;
+    if (!slot->validator.validity.valid) {
+        finish_file(job, slot, 0);
+        return;
+    }
+
+    int error = submit_read(job, slot);
+    if (error) finish_file(job, slot, error);
+}
+
+static void bulk_worker(void* arg) {
+    bulk_job* job = arg;
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        while (job->queue_len == 0 && !job->stop) pthread_cond_wait(&job->completed, &job->lock);
+        if (job->queue_len == 0) {
+            pthread_mutex_unlock(&job->lock);
+            return;
+        }
+        size_t slot = job->queue[job->queue_head];
+        job->queue_head = (job->queue_head + 1) % job->depth;
+        job->queue_len--;
+        pthread_mutex_unlock(&job->lock);
+
+        process_slot(job, &job->slots[slot]);
+    }
+}
+
+// Waits until the completion queue has entries or the last file is done. Returns 0 or the errno of `poll`.
+static int wait_bulk_events(bulk_job* job) {
+    struct pollfd fds[] = {
+        { .fd = job->ring.fd, .events = POLLIN },
+        { .fd = job->wake_fd, .events = POLLIN },
+    };
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) return errno;
+    }
+    return 0;
+}
+
+// Hands completions to the workers until the last file is done. If waiting for completions fails, no reads are
+// submitted anymore and the reads in flight are drained by polling the completion queue, because their buffers
+// must not be freed before the kernel is done with them.
+static void* bulk_reaper(void* arg) {
+    bulk_job* job = arg;
+    uring* ring = &job->ring;
+
+    while (1) {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        pthread_mutex_lock(&job->lock);
+        for (; head != tail; head++) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            bulk_slot* slot = &job->slots[cqe->user_data];
+            slot->res = cqe->res;
+            job->queue[(job->queue_head + job->queue_len++) % job->depth] = (size_t)cqe->user_data;
+            job->in_flight--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&job->completed);
+
+        // after a failure the workers fail the remaining files without reading them
+        bool done = job->in_flight == 0 && (job->files_done == job->files->n || job->failed);
+        int failed = job->failed;
+        pthread_mutex_unlock(&job->lock);
+        if (done) break;
+
+        if (failed) {
+            nanosleep(&(struct timespec) { .tv_sec = 0, .tv_nsec = 1000000 }, NULL);
+            continue;
+        }
+
+        int error = wait_bulk_events(job);
+        if (error) {
+            pthread_mutex_lock(&job->lock);
+            job->failed = error;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->stop = true;
+    pthread_cond_broadcast(&job->completed);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// Returns -1 if io_uring is not available, which makes the caller fall back to blocking reads.
+static int validate_files_uring(bulk_files* files, utf8_bulk_config config) {
+    size_t depth = config.queue_depth < files->n ? config.queue_depth : files->n;
+
+    bulk_job job = { .files = files, .block_size = config.block_size, .depth = depth };
+    if (!open_uring(&job.ring, (unsigned)depth)) return -1;
+
+    job.wake_fd = eventfd(0, EFD_CLOEXEC);
+    job.slots = calloc(depth, sizeof(bulk_slot));
+    job.queue = malloc(depth * sizeof(size_t));
+    char* buffers = malloc(depth * config.block_size);
+    if (job.wake_fd < 0 || !job.slots || !job.queue || !buffers) {
+        int error = job.wake_fd < 0 ? errno : ENOMEM;
+        if (job.wake_fd >= 0) close(job.wake_fd);
+        free(job.slots);
+        free(job.queue);
+        free(buffers);
+        close_uring(&job.ring);
+        return error;
+    }
+    for (size_t i = 0; i < depth; i++) job.slots[i].buffer = buffers + i * config.block_size;
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.completed, NULL);
+
+    // nothing is submitted before the reaper runs, so a failure leaves no read in flight
+    pthread_t reaper;
+    int error = pthread_create(&reaper, NULL, bulk_reaper, &job);
+    if (!error) {
+        for (size_t i = 0; i < depth; i++) start_next_file(&job, &job.slots[i]);
+        run_bulk_threads(bulk_worker, &job, config.threads);
+        // the reaper returns once no read is in flight anymore, so the buffers can be freed
+        pthread_join(reaper, NULL);
+        error = job.failed;
+    }
+
+    pthread_cond_destroy(&job.completed);
+    pthread_mutex_destroy(&job.lock);
+    close(job.wake_fd);
+    free(buffers);
+    free(job.queue);
+    free(job.slots);
+    close_uring(&job.ring);
+    return error;
+}
+
+#endif
+
+int validate_utf8_files(const char* const* paths, size_t n, utf8_bulk_config config, utf8_file_validity* results) {
+    if (n == 0) return 0;
+    if (config.queue_depth == 0) config.queue_depth = 1;
+    if (config.block_size == 0 || config.block_size > (1u << 30)) config.block_size = default_utf8_bulk_config().block_size;
+    if (config.threads == 0) config.threads = 1;
+
+    bulk_files files = { .paths = paths, .n = n, .results = results, .next_file = 0 };
+    pthread_mutex_init(&files.lock, NULL);
+
+    int error = -1;
+#ifdef HAVE_IO_URING
+    error = validate_files_uring(&files, config);
+#endif
+    if (error < 0) {
+        run_bulk_threads(validate_files_blocking, &files, config.threads);
+        error = 0;
+    }
+
+    pthread_mutex_destroy(&files.lock);
+    return error;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file utf8_io.h
+ * @brief validating, counting and sanitizing UTF-8 files without reading them into memory (POSIX)
+ *
+ * @code
+ * #include "utf8_io.h"
+ * #include <stdio.h>
+ * #include <string.h>
+ *
+ * int main(int argc, char** argv) {
+ *     utf8_file_validity result = validate_utf8_file(argv[1]);
+ *     if (result.error) printf("%s: %s\n", argv[1], strerror(result.error));
+ *     else if (!result.validity.valid) printf("%s: invalid at byte %zu\n", argv[1], result.validity.valid_upto);
+ *     return 0;
+ * }
+ * @endcode
+ */
+
+#ifndef ZAHASH_UTF8_IO_H
+#define ZAHASH_UTF8_IO_H
+
+#include "utf8.h"
+
+/**
+ * @brief Result of validating a file.
+ */
+typedef struct {
+    utf8_validity validity;  ///< Validity of the file contents, `valid_upto` is a byte offset into the file.
+    size_t byte_len;         ///< Number of bytes read. Reading stops at the first invalid sequence.
+    int error;               ///< 0 on success; otherwise the `errno` of the failed I/O and `validity` is invalid.
+} utf8_file_validity;
+
+/**
+ * @brief Result of scanning a file with `scan_utf8_text` statistics.
+ */
+typedef struct {
+    utf8_text_stats stats;   ///< Statistics of the file contents (of its valid prefix, if it is invalid).
+    size_t byte_len;         ///< Number of bytes read. Reading stops at the first invalid sequence.
+    int error;               ///< 0 on success; otherwise the `errno` of the failed I/O and `stats.validity` is invalid.
+} utf8_file_stats;
+
+/**
+ * @brief Validates the file at `path` in O(n) time and O(1) heap memory.
+ *
+ * @details Regular files are memory mapped window by window with sequential access and huge page hints,
+ *          so the file is validated in place in the page cache without being copied into a heap buffer.
+ *          Anything that cannot be mapped (pipes, sockets, character devices) is read in fixed size blocks instead.
+ *
+ * @param path The path of the file.
+ * @return The validity of the file contents, or an `errno` in `error` if the file could not be opened or read.
+ */
+utf8_file_validity validate_utf8_file(const char* path);
+
+/**
+ * @brief Same as `validate_utf8_file` for an open file descriptor, read from its current position to the end.
+ *
+ * @param fd The file descriptor. It is not closed.
+ */
+utf8_file_validity validate_utf8_fd(int fd);
+
+/**
+ * @brief Validates the file at `path` and counts its characters and lines (see `scan_utf8_text`) in a single pass.
+ *
+ * @details Same I/O strategy as `validate_utf8_file`.
+ *
+ * @param path The path of the file.
+ * @return The statistics of the file contents, or an `errno` in `error` if the file could not be opened or read.
+ */
+utf8_file_stats scan_utf8_file(const char* path);
+
+/**
+ * @brief Same as `scan_utf8_file` for an open file descriptor, read from its current position to the end.
+ *
+ * @param fd The file descriptor. It is not closed.
+ */
+utf8_file_stats scan_utf8_fd(int fd);
+
+/**
+ * @brief Result of `sanitize_utf8_fd`.
+ */
+typedef struct {
+    size_t bytes_read;       ///< Number of bytes read from the input.
+    size_t bytes_written;    ///< Number of bytes written to the output.
+    size_t replacements;     ///< Number of invalid sequences replaced with U+FFFD.
+    int error;               ///< 0 on success; otherwise the `errno` of the failed read or write.
+} utf8_sanitize_result;
+
+/**
+ * @brief Copies everything from `in_fd` to `out_fd`, replacing invalid UTF-8 sequences with U+FFFD REPLACEMENT CHARACTER (�).
+ *
+ * @details The output is the same as `make_utf8_string_lossy` would produce for the whole input
+ *          (except that '\0' bytes are copied like any other valid character), but in O(1) memory:
+ *          the input is read in large blocks and a character cut by a block boundary is carried over to the next block.
+ *          Valid regions are written straight from the read buffer with `writev`, interleaved with a shared
+ *          replacement character, so no block is ever copied into an intermediate output buffer.
+ *
+ *          Suitable for sockets and pipes on either side. Reads and writes are retried on `EINTR`.
+ *
+ * @param in_fd The descriptor to read from, until end of file.
+ * @param out_fd The descriptor to write to.
+ * @return The number of bytes read and written and of replacements made, or an `errno` in `error`.
+ */
+utf8_sanitize_result sanitize_utf8_fd(int in_fd, int out_fd);
+
+/**
+ * @brief Tuning of `validate_utf8_files`.
+ */
+typedef struct {
+    size_t queue_depth;  ///< Maximum number of reads in flight, which is also the number of files open at a time.
+    size_t block_size;   ///< Size of every read in bytes.
+    size_t threads;      ///< Number of validation threads.
+} utf8_bulk_config;
+
+/**
+ * @brief Returns the default `validate_utf8_files` configuration:
+ *        64 reads of 256 KiB in flight and one validation thread per online CPU.
+ */
+utf8_bulk_config default_utf8_bulk_config(void);
+
+/**
+ * @brief Validates many files at once, overlapping their reads with the validation of already read blocks.
+ *
+ * @details Reads are submitted asynchronously through io_uring, at most `config.queue_depth` at a time,
+ *          each file having one read in flight. Completed blocks are fed to a streaming `utf8_validator`
+ *          per file by `config.threads` threads, which submit the next read of the file right away,
+ *          so the CPU keeps validating while the disk serves the other files.
+ *          Reading a file stops at its first invalid sequence.
+ *
+ *          Where io_uring is unavailable (old kernels, seccomp filters, non-Linux systems) the threads
+ *          validate the files one by one with `validate_utf8_file` instead.
+ *
+ *          The threads are started for the call rather than taken from the shared `utf8_pool`, because they
+ *          block on reads: the parallel functions of utf8_pool.h keep their threads meanwhile.
+ *
+ * @param paths The paths of the files.
+ * @param n The number of files.
+ * @param config The queue depth, block size and thread count, see `default_utf8_bulk_config`.
+ * @param results Receives the result of `paths[i]` in `results[i]`, as `validate_utf8_file` would return it.
+ * @return 0 on success; otherwise the `errno` of the failed thread or memory allocation and `results` are unspecified.
+ *
+ * @code
+ * utf8_file_validity* results = malloc(n * sizeof(utf8_file_validity));
+ * if (validate_utf8_files(paths, n, default_utf8_bulk_config(), results) == 0) {
+ *     for (size_t i = 0; i < n; i++)
+ *         if (!results[i].validity.valid) printf("%s: invalid\n", paths[i]);
+ * }
+ * free(results);
+ * @endcode
+ */
+int validate_utf8_files(const char* const* paths, size_t n, utf8_bulk_config config, utf8_file_validity* results);
+
+#endif
@@ -0,0 +1,268 @@
+#include "utf8_json.h"
+#include "utf8_swar.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char* str;
+    size_t len;
+    size_t cap;
+} json_buffer;
+
+// Non-zero if any of the 8 bytes of `word` must be escaped: '"', '\' or a control character.
+static uint64_t escaped_bytes(uint64_t word) {
+    return has_byte(word, '"') | has_byte(word, '\\') | ((word - LOW_BITS * 0x20) & ~word & HIGH_BITS);
+}
+
+// Length of the run at the start of `str` that is copied as is: everything up to the first byte that is escaped
+// (or that is non-ASCII, with `ascii_only`), 8 bytes at a time as long as a whole word is copied.
+// Sets `non_ascii` if the run has non-ASCII bytes, which then have to be validated.
+static size_t copy_run_len(const char* str, size_t byte_len, bool ascii_only, bool* non_ascii) {
+    uint64_t stop_high = ascii_only ? HIGH_BITS : 0;
+    uint64_t seen = 0;
+    size_t offset = 0;
+    for (; byte_len - offset >= 8; offset += 8) {
+        uint64_t word = load_word(str + offset);
+        if (escaped_bytes(word) | (word & stop_high)) break;
+        seen |= word;
+    }
+    for (; offset < byte_len; offset++) {
+        uint8_t byte = (uint8_t)str[offset];
+        if (byte < 0x20 || byte == '"' || byte == '\\' || (ascii_only && byte >= 0x80)) break;
+        seen |= byte;
+    }
+    *non_ascii = (seen & HIGH_BITS) != 0;
+    return offset;
+}
+
+// Validates a run like `validate_utf8_n`, which accepts characters up to F7 BF BF BF, and also rejects characters
+// beyond U+10FFFF (F4 90 80 80 and above): JSON text is Unicode, and escaping them would give lone surrogates.
+static utf8_validity validate_json_run(const char* run, size_t run_len) {
+    utf8_validity validity = validate_utf8_n(run, run_len);
+
+    // such characters have lead bytes from F4, which are rare, so words without any are skipped
+    size_t offset = 0;
+    while (run_len - offset >= 8 && !bytes_at_least(load_word(run + offset), 0xF4)) offset += 8;
+    for (; offset < validity.valid_upto; offset++) {
+        uint8_t byte = (uint8_t)run[offset];
+        if (byte > 0xF4 || (byte == 0xF4 && (uint8_t)run[offset + 1] >= 0x90))
+            return (utf8_validity) { .valid = false, .valid_upto = offset };
+    }
+    return validity;
+}
+
+// Copies a run found by `copy_run_len`, validating it if it has non-ASCII bytes. A run ends at an ASCII byte (or at the
+// end of the input), which is always a character boundary, so the run can be validated on its own.
+static bool copy_run(json_buffer* buffer, const char* run, size_t run_len, bool non_ascii, utf8_validity* validity) {
+    if (non_ascii) {
+        *validity = validate_json_run(run, run_len);
+        if (!validity->valid) return false;
+    }
+    memcpy(buffer->str + buffer->len, run, run_len);
+    buffer->len += run_len;
+    return true;
+}
+
+// Length of the run of non-ASCII bytes at the start of `str`. In valid UTF-8 such a run is made of whole characters.
+static size_t non_ascii_run_len(const char* str, size_t byte_len) {
+    size_t offset = 0;
+    while (byte_len - offset >= 8 && (load_word(str + offset) & HIGH_BITS) == HIGH_BITS) offset += 8;
+    while (offset < byte_len && (uint8_t)str[offset] >= 0x80) offset++;
+    return offset;
+}
+
+// Makes room for `extra` more bytes and the terminating '\0'.
+static bool reserve(json_buffer* buffer, size_t extra) {
+    if (buffer->len + extra < buffer->cap) return true;
+
+    size_t cap = buffer->cap * 2;
+    if (cap <= buffer->len + extra) cap = buffer->len + extra + 1;
+
+    char* str = realloc(buffer->str, cap);
+    if (!str) return false;
+    buffer->str = str;
+    buffer->cap = cap;
+    return true;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Writes \uXXXX, the caller reserves 6 bytes.
+static void put_u_escape(json_buffer* buffer, uint32_t unit) {
+    char* out = buffer->str + buffer->len;
+    out[0] = '\\';
+    out[1] = 'u';
+    out[2] = hex_digits[(unit >> 12) & 0xF];
+    out[3] = hex_digits[(unit >> 8) & 0xF];
+    out[4] = hex_digits[(unit >> 4) & 0xF];
+    out[5] = hex_digits[unit & 0xF];
+    buffer->len += 6;
+}
+
+// Writes the characters of a valid non-ASCII run as \uXXXX escapes, surrogate pairs beyond U+FFFF.
+static bool put_u_escapes(json_buffer* buffer, const char* run, size_t run_len) {
+    for (size_t offset = 0; offset < run_len;) {
+        utf8_char ch = { .str = run + offset, .byte_len = utf8_lead_byte_len((uint8_t)run[offset]) };
+        uint32_t code_point = unicode_code_point(ch);
+        offset += ch.byte_len;
+
+        if (!reserve(buffer, 12)) return false;
+        if (code_point < 0x10000) {
+            put_u_escape(buffer, code_point);
+        } else {
+            code_point -= 0x10000;
+            put_u_escape(buffer, 0xD800 + (code_point >> 10));
+            put_u_escape(buffer, 0xDC00 + (code_point & 0x3FF));
+        }
+    }
+    return true;
+}
+
+static utf8_json_result json_error(json_buffer* buffer, bool valid, size_t offset) {
+    free(buffer->str);
+    return (utf8_json_result) { .str = { .str = NULL, .byte_len = 0 }, .validity = { .valid = valid, .valid_upto = offset } };
+}
+
+static utf8_json_result json_done(json_buffer* buffer, size_t byte_len) {
+    buffer->str[buffer->len] = '\0';
+    return (utf8_json_result) {
+        .str = { .str = buffer->str, .byte_len = buffer->len },
+        .validity = { .valid = true, .valid_upto = byte_len },
+    };
+}
+
+utf8_json_result escape_utf8_json(const char* str, size_t byte_len, bool ascii_only) {
+    if (str == NULL) return (utf8_json_result) { .str = { NULL, 0 }, .validity = { .valid = false, .valid_upto = 0 } };
+
+    // most strings need few escapes, the buffer grows when they need more
+    json_buffer buffer = { .str = NULL, .len = 0, .cap = 0 };
+    if (!reserve(&buffer, byte_len + byte_len / 8 + 16)) return json_error(&buffer, true, 0);
+
+    size_t offset = 0;
+    while (offset < byte_len) {
+        bool non_ascii;
+        size_t run = copy_run_len(str + offset, byte_len - offset, ascii_only, &non_ascii);
+        utf8_validity validity;
+        if (!reserve(&buffer, run)) return json_error(&buffer, true, 0);
+        if (!copy_run(&buffer, str + offset, run, non_ascii, &validity)) return json_error(&buffer, false, offset + validity.valid_upto);
+        offset += run;
+        if (offset == byte_len) break;
+
+        // with ascii_only, non-ASCII characters are escaped
+        if ((uint8_t)str[offset] >= 0x80) {
+            run = non_ascii_run_len(str + offset, byte_len - offset);
+            validity = validate_json_run(str + offset, run);
+            if (!validity.valid) return json_error(&buffer, false, offset + validity.valid_upto);
+            if (!put_u_escapes(&buffer, str + offset, run)) return json_error(&buffer, true, 0);
+            offset += run;
+            continue;
+        }
+
+        uint8_t byte = (uint8_t)str[offset];
+        if (!reserve(&buffer, 6)) return json_error(&buffer, true, 0);
+        char escape = 0;
+        switch (byte) {
+        case '"': escape = '"'; break;
+        case '\\': escape = '\\'; break;
+        case '\b': escape = 'b'; break;
+        case '\f': escape = 'f'; break;
+        case '\n': escape = 'n'; break;
+        case '\r': escape = 'r'; break;
+        case '\t': escape = 't'; break;
+        }
+        if (escape) {
+            buffer.str[buffer.len++] = '\\';
+            buffer.str[buffer.len++] = escape;
+        } else {
+            put_u_escape(&buffer, byte);
+        }
+        offset++;
+    }
+
+    return json_done(&buffer, byte_len);
+}
+
+// Value of the 4 hex digits at `str`, or -1.
+static int32_t parse_hex4(const char* str) {
+    int32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = str[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return -1;
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+// Parses the \uXXXX escape at `offset` (and the low surrogate escape following a high one).
+// Returns the code point and sets `next` past the escape(s), or returns -1 if the escape is invalid.
+static int32_t parse_u_escape(const char* str, size_t byte_len, size_t offset, size_t* next) {
+    if (byte_len - offset < 6) return -1;
+    int32_t unit = parse_hex4(str + offset + 2);
+    if (unit < 0 || (unit >= 0xDC00 && unit <= 0xDFFF)) return -1;
+
+    if (unit >= 0xD800 && unit <= 0xDBFF) {
+        if (byte_len - offset < 12 || str[offset + 6] != '\\' || str[offset + 7] != 'u') return -1;
+        int32_t low = parse_hex4(str + offset + 8);
+        if (low < 0xDC00 || low > 0xDFFF) return -1;
+        *next = offset + 12;
+        return 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+    }
+
+    *next = offset + 6;
+    return unit;
+}
+
+utf8_json_result unescape_utf8_json(const char* str, size_t byte_len) {
+    if (str == NULL) return (utf8_json_result) { .str = { NULL, 0 }, .validity = { .valid = false, .valid_upto = 0 } };
+
+    // unescaping never makes the string longer
+    json_buffer buffer = { .str = malloc(byte_len + 1), .len = 0, .cap = byte_len + 1 };
+    if (!buffer.str) return json_error(&buffer, true, 0);
+
+    size_t offset = 0;
+    while (offset < byte_len) {
+        bool non_ascii;
+        size_t run = copy_run_len(str + offset, byte_len - offset, false, &non_ascii);
+        utf8_validity validity;
+        if (!copy_run(&buffer, str + offset, run, non_ascii, &validity)) return json_error(&buffer, false, offset + validity.valid_upto);
+        offset += run;
+        if (offset == byte_len) break;
+
+        uint8_t byte = (uint8_t)str[offset];
+
+        // '"' and control characters must be escaped
+        if (byte != '\\' || offset + 1 == byte_len) return json_error(&buffer, false, offset);
+
+        char unescaped = 0;
+        switch (str[offset + 1]) {
+        case '"': unescaped = '"'; break;
+        case '\\': unescaped = '\\'; break;
+        case '/': unescaped = '/'; break;
+        case 'b': unescaped = '\b'; break;
+        case 'f': unescaped = '\f'; break;
+        case 'n': unescaped = '\n'; break;
+        case 'r': unescaped = '\r'; break;
+        case 't': unescaped = '\t'; break;
+        case 'u': {
+            size_t next;
+            int32_t code_point = parse_u_escape(str, byte_len, offset, &next);
+            if (code_point < 0) return json_error(&buffer, false, offset);
+            // an escape is at least as long as the character it encodes, so there is room for it
+            buffer.len += put_utf8(buffer.str + buffer.len, (uint32_t)code_point);
+            offset = next;
+            continue;
+        }
+        default:
+            return json_error(&buffer, false, offset);
+        }
+        buffer.str[buffer.len++] = unescaped;
+        offset += 2;
+    }
+
+    return json_done(&buffer, byte_len);
+}
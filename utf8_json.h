@@ -0,0 +1,85 @@
+/**
+ * @file utf8_json.h
+ * @brief escaping UTF-8 strings for JSON and unescaping JSON strings, validating the UTF-8 in the same pass
+ *
+ * @code
+ * #include "utf8_json.h"
+ * #include <stdio.h>
+ *
+ * int main() {
+ *     const char* name = "say \"こんにちは\"\n";
+ *     utf8_json_result escaped = escape_utf8_json(name, strlen(name), false);
+ *     if (escaped.str.str) printf("{\"name\": \"%s\"}\n", escaped.str.str);    // say \"こんにちは\"\n
+ *     free_owned_utf8_string(&escaped.str);
+ *     return 0;
+ * }
+ * @endcode
+ */
+
+#ifndef ZAHASH_UTF8_JSON_H
+#define ZAHASH_UTF8_JSON_H
+
+#include "utf8.h"
+
+/**
+ * @brief Result of escaping or unescaping a JSON string.
+ *
+ * @details On success `str` holds the result and `validity.valid` is true. If the input is invalid, `str` is
+ *          { NULL, 0 } and `validity.valid_upto` is the byte offset of the invalid UTF-8 sequence (or escape sequence).
+ *          If memory ran out, `str` is { NULL, 0 } while `validity.valid` is true.
+ */
+typedef struct {
+    owned_utf8_string str;   ///< The resulting string ('\0' terminated), to be freed with `free_owned_utf8_string`.
+    utf8_validity validity;  ///< Validity of the input, see above.
+} utf8_json_result;
+
+/**
+ * @brief Escapes a UTF-8 string to be the contents of a JSON string (the surrounding quotes are not added).
+ *
+ * @details '"' and '\' are escaped with a backslash, control characters as \b \f \n \r \t or \u00XX.
+ *          Runs of other ASCII characters are found 8 bytes at a time and copied as a whole, and runs of non-ASCII
+ *          characters are validated (see `validate_utf8_n`) and copied as a whole, so the input is validated
+ *          while it is escaped. With `ascii_only`, non-ASCII characters are written as \uXXXX escapes instead,
+ *          those beyond U+FFFF as UTF-16 surrogate pairs.
+ *
+ *          '\0' bytes are characters like any other and are written as \u0000. Unlike `validate_utf8_n`,
+ *          characters beyond U+10FFFF (F4 90 80 80 and above) are invalid: they have no \uXXXX escape.
+ *
+ * @param str The string to escape.
+ * @param byte_len The number of bytes in `str`.
+ * @param ascii_only Whether to escape non-ASCII characters too, making the result pure ASCII.
+ * @return The escaped string, or the position of the first invalid UTF-8 sequence.
+ *
+ * @code
+ * // Example usage:
+ * utf8_json_result r = escape_utf8_json("tab\t😁", 8, true);
+ * assert( strcmp(r.str.str, "tab\\t\\ud83d\\ude01") == 0 );
+ * free_owned_utf8_string(&r.str);
+ * @endcode
+ */
+utf8_json_result escape_utf8_json(const char* str, size_t byte_len, bool ascii_only);
+
+/**
+ * @brief Unescapes the contents of a JSON string (without the surrounding quotes) into UTF-8.
+ *
+ * @details Accepts the escapes of RFC 8259: \" \\ \/ \b \f \n \r \t and \uXXXX, where a surrogate pair of
+ *          \uXXXX escapes makes a single character. Unescaped runs are found 8 bytes at a time and copied as a whole,
+ *          non-ASCII runs are validated on the way. The result is never longer than the input.
+ *
+ *          Invalid are: invalid UTF-8 (characters beyond U+10FFFF included), unknown or truncated escapes, lone surrogates, and the characters JSON requires
+ *          to be escaped ('"' and control characters). A \u0000 escape gives a '\0' byte, counted in `byte_len`.
+ *
+ * @param str The JSON string contents.
+ * @param byte_len The number of bytes in `str`.
+ * @return The unescaped string, or the position of the first invalid UTF-8 or escape sequence.
+ *
+ * @code
+ * // Example usage:
+ * utf8_json_result r = unescape_utf8_json("\\u3053\\ud83d\\ude01\\n", 20);
+ * assert( strcmp(r.str.str, "こ😁\n") == 0 );
+ * free_owned_utf8_string(&r.str);
+ * @endcode
+ */
+utf8_json_result unescape_utf8_json(const char* str, size_t byte_len);
+
+#endif
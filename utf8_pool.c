@@ -0,0 +1,602 @@
+// pthread_setaffinity_np and cpu_set_t
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "utf8_pool.h"
+#include "utf8_swar.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// Parallel operations hand out chunks of at least this size, smaller inputs are processed on the calling thread.
+#define MIN_PARALLEL_CHUNK (256 << 10)
+
+// Chunks per worker, so that workers finishing early can steal from slower ones.
+#define CHUNKS_PER_WORKER 4
+
+// Pages per chunk whose NUMA node is looked up to find the node a chunk belongs to.
+#define NODE_SAMPLES 8
+
+// CPUs and NUMA nodes beyond these are treated as unknown.
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+
+typedef struct {
+    _Atomic size_t pending;  // tasks not finished yet
+} task_group;
+
+typedef struct {
+    utf8_task_fn fn;
+    void* arg;
+    task_group* group;
+} task;
+
+// A ring buffer of tasks. The owner pushes and pops at the back, thieves take from the front.
+typedef struct {
+    pthread_mutex_t lock;
+    task* tasks;
+    size_t cap;
+    size_t front;
+    size_t len;
+} task_deque;
+
+typedef struct {
+    utf8_pool* pool;
+    size_t index;
+    int cpu;   // -1 when not pinned to a single CPU
+    int node;  // NUMA node the worker runs on, -1 when unknown
+    pthread_t thread;
+    task_deque deque;
+} pool_worker;
+
+struct utf8_pool {
+    pool_worker* workers;
+    size_t nworkers;
+    size_t nnodes;               // distinct NUMA nodes of the workers
+    bool numa;                   // partition and schedule by NUMA node
+
+    _Atomic size_t queued;       // tasks in all deques
+    _Atomic size_t next_deque;   // round robin target of tasks submitted from outside the pool
+
+    // workers and waiting threads sleep here while there is nothing to run
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    bool stop;
+};
+
+// the worker the current thread is, NULL outside of any pool
+static _Thread_local pool_worker* current_worker = NULL;
+
+// NUMA node of every CPU as listed in sysfs, -1 for CPUs without one. Without sysfs everything is on node 0.
+static int cpu_nodes[MAX_CPUS];
+static size_t topology_nodes = 1;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+// Reads a cpulist such as "0-3,8-11" and assigns its CPUs to `node`.
+static void read_cpulist(FILE* f, int node) {
+    int first, last;
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        int c = fgetc(f);
+        if (c == '-' && fscanf(f, "%d", &last) == 1) c = fgetc(f);
+        for (int cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++) if (cpu >= 0) cpu_nodes[cpu] = node;
+        if (c != ',') break;
+    }
+}
+
+static void load_topology(void) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) cpu_nodes[cpu] = cpu < online ? 0 : -1;
+
+#ifdef __linux__
+    size_t nodes = 0;
+    for (int node = 0; node < MAX_NODES; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+
+        if (nodes == 0) for (int cpu = 0; cpu < MAX_CPUS; cpu++) cpu_nodes[cpu] = -1;
+        read_cpulist(f, node);
+        fclose(f);
+        nodes++;
+    }
+    if (nodes > 0) topology_nodes = nodes;
+#endif
+}
+
+// Node of the `i`th CPU that has one, counting around, so that workers spread over the nodes like the CPUs do.
+static int nth_cpu_node(size_t i) {
+    size_t ncpus = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) ncpus += cpu_nodes[cpu] >= 0;
+    if (ncpus == 0) return -1;
+
+    i %= ncpus;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+        if (cpu_nodes[cpu] >= 0 && i-- == 0) return cpu_nodes[cpu];
+    return -1;
+}
+
+// NUMA node of the page holding each of the `n` addresses, -1 where unknown (not faulted in yet, or no NUMA support).
+static void query_page_nodes(const void** pages, size_t n, int* nodes) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    // move_pages without target nodes only reports where the pages are
+    if (syscall(SYS_move_pages, 0, (unsigned long)n, pages, NULL, nodes, 0) == 0) {
+        for (size_t i = 0; i < n; i++) if (nodes[i] < 0) nodes[i] = -1;
+        return;
+    }
+#else
+    (void)pages;
+#endif
+    for (size_t i = 0; i < n; i++) nodes[i] = -1;
+}
+
+static bool push_task(task_deque* deque, task t) {
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->len == deque->cap) {
+        size_t cap = deque->cap ? deque->cap * 2 : 64;
+        task* tasks = malloc(cap * sizeof(task));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (size_t i = 0; i < deque->len; i++) tasks[i] = deque->tasks[(deque->front + i) % deque->cap];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->cap = cap;
+        deque->front = 0;
+    }
+
+    deque->tasks[(deque->front + deque->len++) % deque->cap] = t;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static bool pop_back_task(task_deque* deque, task* t) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->len > 0;
+    if (found) *t = deque->tasks[(deque->front + --deque->len) % deque->cap];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool pop_front_task(task_deque* deque, task* t) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->len > 0;
+    if (found) {
+        *t = deque->tasks[deque->front];
+        deque->front = (deque->front + 1) % deque->cap;
+        deque->len--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Takes a task for `self` (NULL for a thread outside the pool): its own newest task first, otherwise the
+// oldest task of another worker, visiting them in order starting after `self`. On a NUMA pool workers
+// steal from workers on their own node first, whose tasks are more likely to use memory of that node.
+static bool find_task(utf8_pool* pool, pool_worker* self, task* t) {
+    if (atomic_load_explicit(&pool->queued, memory_order_acquire) == 0) return false;
+
+    bool found = self && pop_back_task(&self->deque, t);
+    size_t start = self ? self->index + 1 : 0;
+    bool local_first = self && pool->numa && self->node >= 0;
+
+    for (int pass = local_first ? 0 : 1; !found && pass < 2; pass++) {
+        for (size_t i = 0; !found && i < pool->nworkers; i++) {
+            pool_worker* victim = &pool->workers[(start + i) % pool->nworkers];
+            if (pass == 0 && victim->node != self->node) continue;
+            found = pop_front_task(&victim->deque, t);
+        }
+    }
+
+    if (found) atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_relaxed);
+    return found;
+}
+
+static void wake_all(utf8_pool* pool) {
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+static void run_task(utf8_pool* pool, task t) {
+    t.fn(t.arg);
+
+    // the group lives on the waiting thread's stack and must not be touched once it reaches 0
+    if (atomic_fetch_sub_explicit(&t.group->pending, 1, memory_order_acq_rel) == 1) wake_all(pool);
+}
+
+static void* worker_main(void* arg) {
+    pool_worker* self = arg;
+    utf8_pool* pool = self->pool;
+    current_worker = self;
+
+    while (1) {
+        task t;
+        if (find_task(pool, self, &t)) {
+            run_task(pool, t);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleep_lock);
+        while (!pool->stop && atomic_load(&pool->queued) == 0) pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        bool stop = pool->stop;
+        pthread_mutex_unlock(&pool->sleep_lock);
+        if (stop) return NULL;
+    }
+}
+
+// Starts the worker, already bound to its CPU or node if it has one.
+static int start_worker(pool_worker* worker) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+#ifdef __linux__
+    // a worker is pinned to its CPU, or bound to all CPUs of its node on a NUMA pool
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (worker->cpu >= 0 && worker->cpu < CPU_SETSIZE) {
+        CPU_SET(worker->cpu, &set);
+    } else if (worker->pool->numa && worker->node >= 0) {
+        for (int cpu = 0; cpu < MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+            if (cpu_nodes[cpu] == worker->node) CPU_SET(cpu, &set);
+    }
+    if (CPU_COUNT(&set) > 0) pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+#endif
+
+    int error = pthread_create(&worker->thread, &attr, worker_main, worker);
+    pthread_attr_destroy(&attr);
+    return error;
+}
+
+utf8_pool_config default_utf8_pool_config(void) {
+    return (utf8_pool_config) { .threads = 0, .cpus = NULL, .ncpus = 0, .ignore_numa = false };
+}
+
+utf8_pool* make_utf8_pool(utf8_pool_config config) {
+    if (config.threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        config.threads = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    utf8_pool* pool = calloc(1, sizeof(utf8_pool));
+    if (!pool) return NULL;
+    pool->workers = calloc(config.threads, sizeof(pool_worker));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    // nodes of pinned workers follow from their CPUs, other workers are spread over the nodes like the CPUs
+    pthread_once(&topology_once, load_topology);
+    bool seen[MAX_NODES] = { false };
+    for (size_t i = 0; i < config.threads; i++) {
+        pool_worker* worker = &pool->workers[i];
+        worker->cpu = config.cpus && config.ncpus > 0 ? config.cpus[i % config.ncpus] : -1;
+        if (worker->cpu >= 0) worker->node = worker->cpu < MAX_CPUS ? cpu_nodes[worker->cpu] : -1;
+        else worker->node = !config.ignore_numa && topology_nodes > 1 ? nth_cpu_node(i) : -1;
+
+        if (worker->node >= 0 && worker->node < MAX_NODES && !seen[worker->node]) {
+            seen[worker->node] = true;
+            pool->nnodes++;
+        }
+    }
+    if (pool->nnodes == 0) pool->nnodes = 1;
+    pool->numa = !config.ignore_numa && pool->nnodes > 1;
+
+    for (size_t i = 0; i < config.threads; i++) {
+        pool_worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+
+        if (start_worker(worker) != 0) {
+            pthread_mutex_destroy(&worker->deque.lock);
+            break;
+        }
+        pool->nworkers++;
+    }
+
+    if (pool->nworkers == 0) {
+        free_utf8_pool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void free_utf8_pool(utf8_pool* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    for (size_t i = 0; i < pool->nworkers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->sleep_lock);
+    free(pool->workers);
+    free(pool);
+}
+
+static pthread_mutex_t default_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static utf8_pool* default_pool = NULL;
+static bool default_pool_started = false;
+static utf8_pool_config default_pool_config = { .threads = 0, .cpus = NULL, .ncpus = 0, .ignore_numa = false };
+static int* default_pool_cpus = NULL;
+
+bool configure_utf8_default_pool(utf8_pool_config config) {
+    pthread_mutex_lock(&default_pool_lock);
+    bool applied = !default_pool_started;
+
+    if (applied) {
+        // the caller's array need not outlive this call
+        int* cpus = NULL;
+        if (config.cpus && config.ncpus > 0 && (cpus = malloc(config.ncpus * sizeof(int))))
+            memcpy(cpus, config.cpus, config.ncpus * sizeof(int));
+        free(default_pool_cpus);
+        default_pool_cpus = cpus;
+        default_pool_config = config;
+        default_pool_config.cpus = cpus;
+        default_pool_config.ncpus = cpus ? config.ncpus : 0;
+    }
+
+    pthread_mutex_unlock(&default_pool_lock);
+    return applied;
+}
+
+utf8_pool* utf8_default_pool(void) {
+    pthread_mutex_lock(&default_pool_lock);
+    if (!default_pool_started) {
+        default_pool = make_utf8_pool(default_pool_config);
+        default_pool_started = true;
+    }
+    utf8_pool* pool = default_pool;
+    pthread_mutex_unlock(&default_pool_lock);
+    return pool;
+}
+
+size_t utf8_pool_threads(utf8_pool* pool) {
+    if (!pool) pool = utf8_default_pool();
+    return pool ? pool->nworkers : 0;
+}
+
+size_t utf8_pool_nodes(utf8_pool* pool) {
+    if (!pool) pool = utf8_default_pool();
+    return pool ? pool->nnodes : 0;
+}
+
+// Deque for a task submitted from outside the pool: one of a worker on `node`, or any deque round robin.
+static size_t pick_deque(utf8_pool* pool, int node) {
+    size_t next = atomic_fetch_add_explicit(&pool->next_deque, 1, memory_order_relaxed);
+    if (pool->numa && node >= 0) {
+        for (size_t i = 0; i < pool->nworkers; i++) {
+            size_t target = (next + i) % pool->nworkers;
+            if (pool->workers[target].node == node) return target;
+        }
+    }
+    return next % pool->nworkers;
+}
+
+void run_utf8_pool_tasks(utf8_pool* pool, utf8_task_fn fn, void* args, size_t arg_size, size_t ntasks) {
+    run_utf8_pool_tasks_on_nodes(pool, fn, args, arg_size, ntasks, NULL);
+}
+
+void run_utf8_pool_tasks_on_nodes(utf8_pool* pool, utf8_task_fn fn, void* args, size_t arg_size, size_t ntasks, const int* nodes) {
+    if (!pool) pool = utf8_default_pool();
+    if (!pool) {
+        for (size_t i = 0; i < ntasks; i++) fn((char*)args + i * arg_size);
+        return;
+    }
+
+    task_group group = { .pending = ntasks };
+    pool_worker* self = current_worker && current_worker->pool == pool ? current_worker : NULL;
+
+    // tasks go to the submitting worker's own deque, or are spread over the deques (of their node) from outside the pool
+    size_t queued = 0;
+    for (size_t i = 0; i < ntasks; i++) {
+        task t = { .fn = fn, .arg = (char*)args + i * arg_size, .group = &group };
+        size_t target = self ? self->index : pick_deque(pool, nodes ? nodes[i] : -1);
+
+        if (push_task(&pool->workers[target].deque, t)) {
+            atomic_fetch_add_explicit(&pool->queued, 1, memory_order_release);
+            queued++;
+        } else {
+            run_task(pool, t); // out of memory for the deque, run it right away
+        }
+    }
+    if (queued > 0) wake_all(pool);
+
+    // help until every task of the group is done
+    while (atomic_load_explicit(&group.pending, memory_order_acquire) > 0) {
+        task t;
+        if (find_task(pool, self, &t)) {
+            run_task(pool, t);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleep_lock);
+        while (atomic_load(&group.pending) > 0 && atomic_load(&pool->queued) == 0) pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+typedef struct {
+    const char* str;
+    size_t byte_len;
+    size_t offset;   // of `str` in the whole buffer
+    utf8_validity validity;
+    size_t count;
+    bool has_nul;    // counting stopped at a '\0'
+} chunk_job;
+
+// Node holding most of the sampled pages of the chunk, -1 if none is known.
+static int chunk_node(const chunk_job* job, size_t page) {
+    const void* pages[NODE_SAMPLES];
+    int nodes[NODE_SAMPLES];
+
+    size_t nsamples = job->byte_len / page < NODE_SAMPLES ? job->byte_len / page + 1 : NODE_SAMPLES;
+    for (size_t i = 0; i < nsamples; i++) {
+        uintptr_t address = (uintptr_t)(job->str + job->byte_len / nsamples * i);
+        pages[i] = (const void*)(address - address % page);
+    }
+    query_page_nodes(pages, nsamples, nodes);
+
+    int best = -1;
+    size_t best_votes = 0;
+    for (size_t i = 0; i < nsamples; i++) {
+        size_t votes = 0;
+        for (size_t j = 0; j < nsamples; j++) votes += nodes[j] == nodes[i];
+        if (nodes[i] >= 0 && votes > best_votes) {
+            best = nodes[i];
+            best_votes = votes;
+        }
+    }
+    return best;
+}
+
+// Runs a task per chunk, on a NUMA pool preferably on the node that holds the chunk's memory.
+static void run_chunk_jobs(utf8_pool* pool, utf8_task_fn fn, chunk_job* jobs, size_t njobs) {
+    if (!pool) pool = utf8_default_pool();
+
+    int* nodes = pool && pool->numa ? malloc(njobs * sizeof(int)) : NULL;
+    if (nodes) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < njobs; i++) nodes[i] = chunk_node(&jobs[i], page);
+    }
+
+    run_utf8_pool_tasks_on_nodes(pool, fn, jobs, sizeof(chunk_job), njobs, nodes);
+    free(nodes);
+}
+
+// Splits the buffer into chunks starting on character boundaries. Returns NULL (and `*njobs` 0) when the buffer
+// is too small to be worth splitting or the jobs cannot be allocated.
+static chunk_job* make_chunk_jobs(utf8_pool* pool, const char* str, size_t byte_len, size_t* njobs) {
+    *njobs = 0;
+    size_t workers = utf8_pool_threads(pool);
+    if (workers == 0 || byte_len < 2 * MIN_PARALLEL_CHUNK) return NULL;
+
+    size_t nchunks = byte_len / MIN_PARALLEL_CHUNK;
+    if (nchunks > (workers + 1) * CHUNKS_PER_WORKER) nchunks = (workers + 1) * CHUNKS_PER_WORKER;
+
+    chunk_job* jobs = malloc(nchunks * sizeof(chunk_job));
+    if (!jobs) return NULL;
+
+    size_t chunk_len = byte_len / nchunks;
+    size_t start = 0;
+    for (size_t i = 0; i < nchunks && start < byte_len; i++) {
+        size_t end = i == nchunks - 1 ? byte_len : (i + 1) * chunk_len;
+        if (end < start) end = start;
+
+        // move the boundary past the continuation bytes of the character it cuts
+        for (int k = 0; k < 3 && end < byte_len && !is_char_start((uint8_t)str[end]); k++) end++;
+
+        jobs[*njobs] = (chunk_job) { .str = str + start, .byte_len = end - start, .offset = start };
+        (*njobs)++;
+        start = end;
+    }
+
+    return jobs;
+}
+
+static void validate_chunk_job(void* arg) {
+    chunk_job* job = arg;
+    job->validity = validate_utf8_n(job->str, job->byte_len);
+}
+
+utf8_validity validate_utf8_parallel(utf8_pool* pool, const char* str, size_t byte_len) {
+    if (str == NULL) return (utf8_validity) { .valid = false, .valid_upto = 0 };
+
+    size_t njobs;
+    chunk_job* jobs = make_chunk_jobs(pool, str, byte_len, &njobs);
+    if (!jobs) return validate_utf8_n(str, byte_len);
+
+    run_chunk_jobs(pool, validate_chunk_job, jobs, njobs);
+
+    // the first invalid chunk decides, everything before it is valid
+    utf8_validity validity = { .valid = true, .valid_upto = byte_len };
+    for (size_t i = 0; i < njobs; i++) {
+        if (!jobs[i].validity.valid) {
+            validity = (utf8_validity) { .valid = false, .valid_upto = jobs[i].offset + jobs[i].validity.valid_upto };
+            break;
+        }
+    }
+
+    free(jobs);
+    return validity;
+}
+
+// Counts the bytes that start a character (those that are not continuation bytes) up to the first '\0',
+// 8 bytes at a time while there is no '\0' in the word.
+static size_t count_char_starts(const char* str, size_t byte_len, bool* has_nul) {
+    size_t count = 0;
+    size_t offset = 0;
+
+    for (; byte_len - offset >= 8; offset += 8) {
+        uint64_t word = load_word(str + offset);
+        if (has_zero_byte(word)) break;
+        count += count_char_starts_in_word(word);
+    }
+
+    *has_nul = false;
+    for (; offset < byte_len; offset++) {
+        uint8_t byte = (uint8_t)str[offset];
+        if (byte == 0) {
+            *has_nul = true;
+            break;
+        }
+        count += is_char_start(byte);
+    }
+
+    return count;
+}
+
+static void count_chunk_job(void* arg) {
+    chunk_job* job = arg;
+    job->count = count_char_starts(job->str, job->byte_len, &job->has_nul);
+}
+
+size_t utf8_char_count_parallel(utf8_pool* pool, utf8_string ustr) {
+    if (ustr.str == NULL || ustr.byte_len == 0) return 0;
+
+    // like utf8_char_count, a leading continuation byte is a character of its own and counting ends at '\0'
+    size_t count = !is_char_start((uint8_t)ustr.str[0]);
+
+    size_t njobs;
+    chunk_job* jobs = make_chunk_jobs(pool, ustr.str, ustr.byte_len, &njobs);
+    if (!jobs) {
+        // too short to split (or out of memory): count on the calling thread, still bounded by `byte_len`
+        bool has_nul;
+        return count + count_char_starts(ustr.str, ustr.byte_len, &has_nul);
+    }
+
+    run_chunk_jobs(pool, count_chunk_job, jobs, njobs);
+
+    for (size_t i = 0; i < njobs; i++) {
+        count += jobs[i].count;
+        if (jobs[i].has_nul) break;
+    }
+
+    free(jobs);
+    return count;
+}
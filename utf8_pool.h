@@ -0,0 +1,173 @@
+/**
+ * @file utf8_pool.h
+ * @brief a shared work-stealing thread pool and the parallel bulk operations built on it (POSIX threads)
+ *
+ * @code
+ * #include "utf8_pool.h"
+ *
+ * // validates a large buffer on the default pool, one worker per online CPU
+ * utf8_validity validity = validate_utf8_parallel(NULL, buffer, buffer_len);
+ *
+ * // or on a pool of 4 workers pinned to CPUs 0-3
+ * int cpus[] = { 0, 1, 2, 3 };
+ * utf8_pool* pool = make_utf8_pool((utf8_pool_config) { .threads = 4, .cpus = cpus, .ncpus = 4 });
+ * size_t chars = utf8_char_count_parallel(pool, (utf8_string) { .str = buffer, .byte_len = buffer_len });
+ * free_utf8_pool(pool);
+ * @endcode
+ */
+
+#ifndef ZAHASH_UTF8_POOL_H
+#define ZAHASH_UTF8_POOL_H
+
+#include "utf8.h"
+
+/**
+ * @brief A fixed set of worker threads with one task deque each.
+ *
+ * @details Workers run the tasks of their own deque newest first and steal the oldest tasks of the other deques
+ *          when theirs is empty. Threads waiting for their tasks run queued tasks meanwhile, so operations
+ *          started concurrently from several threads (or from inside a task) share the workers instead of
+ *          each spinning up threads of their own.
+ *
+ *          On machines with several NUMA nodes (Linux), every worker belongs to a node: that of its CPU when it is
+ *          pinned, otherwise workers are spread over the nodes like the CPUs are and bound to the CPUs of their node.
+ *          Tasks can be directed to a node, and workers steal from workers of their own node first.
+ */
+typedef struct utf8_pool utf8_pool;
+
+/**
+ * @brief Configuration of a `utf8_pool`.
+ */
+typedef struct {
+    size_t threads;    ///< Number of worker threads, 0 for one per online CPU.
+    const int* cpus;   ///< CPUs to pin the workers to, worker `i` to `cpus[i % ncpus]`. NULL leaves them to the scheduler (within their NUMA node).
+    size_t ncpus;      ///< Number of entries in `cpus`.
+    bool ignore_numa;  ///< Schedule and partition without regard to NUMA nodes.
+} utf8_pool_config;
+
+/**
+ * @brief A task: called with one argument, on any worker or waiting thread.
+ */
+typedef void (*utf8_task_fn)(void* arg);
+
+/**
+ * @brief Returns the default configuration: one worker per online CPU, unpinned but bound to its NUMA node.
+ */
+utf8_pool_config default_utf8_pool_config(void);
+
+/**
+ * @brief Starts a pool.
+ *
+ * @details The `cpus` array is only read during the call. Pinning is only supported on Linux and is ignored elsewhere.
+ *
+ * @param config The number of workers and their CPUs.
+ * @return The pool, or NULL if it could not be allocated or no worker thread could be started.
+ *         The caller is responsible for stopping it with `free_utf8_pool`.
+ */
+utf8_pool* make_utf8_pool(utf8_pool_config config);
+
+/**
+ * @brief Stops the workers and frees the pool. No tasks may be running on it.
+ *
+ * @param pool The pool to free, NULL is ignored.
+ */
+void free_utf8_pool(utf8_pool* pool);
+
+/**
+ * @brief Configures the shared pool used when NULL is passed as pool.
+ *
+ * @details The shared pool is started on first use. Its configuration can only be changed before that.
+ *
+ * @param config The configuration of the shared pool.
+ * @return true if the configuration was applied, false if the shared pool is already running.
+ */
+bool configure_utf8_default_pool(utf8_pool_config config);
+
+/**
+ * @brief Returns the shared pool, starting it with `default_utf8_pool_config` (or the configuration given to
+ *        `configure_utf8_default_pool`) on first use. The shared pool lives until the process exits.
+ *
+ * @return The shared pool, or NULL if it could not be started.
+ */
+utf8_pool* utf8_default_pool(void);
+
+/**
+ * @brief Number of worker threads of a pool.
+ *
+ * @param pool The pool, NULL for the shared pool.
+ * @return The number of workers, 0 if the shared pool could not be started.
+ */
+size_t utf8_pool_threads(utf8_pool* pool);
+
+/**
+ * @brief Number of NUMA nodes the workers of a pool are spread over.
+ *
+ * @param pool The pool, NULL for the shared pool.
+ * @return The number of nodes, 1 on single node machines or for pools that ignore NUMA, 0 if the shared pool could not be started.
+ */
+size_t utf8_pool_nodes(utf8_pool* pool);
+
+/**
+ * @brief Runs `ntasks` tasks on the pool and returns when all of them are done.
+ *
+ * @details Task `i` is called with `(char*)args + i * arg_size`, so an `arg_size` of 0 passes `args` to every task.
+ *          The calling thread runs tasks too while it waits. Tasks may themselves run tasks on the same pool.
+ *
+ * @param pool The pool, NULL for the shared pool. If there is no pool the tasks run one after another on the calling thread.
+ * @param fn The task.
+ * @param args The task arguments.
+ * @param arg_size The distance in bytes between consecutive task arguments.
+ * @param ntasks The number of tasks.
+ *
+ * @code
+ * // Example usage:
+ * typedef struct { const char* str; size_t len; utf8_validity validity; } job;
+ * void validate_job(void* arg) { job* j = arg; j->validity = validate_utf8_n(j->str, j->len); }
+ *
+ * job jobs[16] = { ... };
+ * run_utf8_pool_tasks(NULL, validate_job, jobs, sizeof(job), 16);
+ * @endcode
+ */
+void run_utf8_pool_tasks(utf8_pool* pool, utf8_task_fn fn, void* args, size_t arg_size, size_t ntasks);
+
+/**
+ * @brief Same as `run_utf8_pool_tasks`, with task `i` queued for a worker on NUMA node `nodes[i]`.
+ *
+ * @details Meant for tasks that mostly touch memory of one node. Other workers may still steal the task
+ *          once the workers of its node are busy. Node hints are ignored on single node pools.
+ *
+ * @param nodes The preferred node of every task, -1 for any. NULL for no preference at all.
+ */
+void run_utf8_pool_tasks_on_nodes(utf8_pool* pool, utf8_task_fn fn, void* args, size_t arg_size, size_t ntasks, const int* nodes);
+
+/**
+ * @brief Same as `validate_utf8_n`, with the buffer split into chunks that are validated in parallel on a pool.
+ *
+ * @details Chunks start on character boundaries: a chunk boundary is moved past up to 3 continuation bytes, so
+ *          the result, including `valid_upto`, is the same as that of `validate_utf8_n`.
+ *          Buffers below a few hundred KiB are validated on the calling thread.
+ *
+ *          On a NUMA pool the node holding each chunk is looked up by sampling its pages (`move_pages`),
+ *          and the chunk is validated on a worker of that node.
+ *
+ * @param pool The pool, NULL for the shared pool.
+ * @param str The buffer to validate.
+ * @param byte_len The number of bytes to validate.
+ * @return The validity of the buffer along with the position up to which it is valid.
+ */
+utf8_validity validate_utf8_parallel(utf8_pool* pool, const char* str, size_t byte_len);
+
+/**
+ * @brief Same as `utf8_char_count`, with the string split into chunks that are counted in parallel on a pool.
+ *
+ * @details Counting stops at `ustr.byte_len` or at the first '\0', whichever comes first.
+ *          Chunks count the bytes that start a character 8 bytes at a time, and are scheduled
+ *          like those of `validate_utf8_parallel`.
+ *
+ * @param pool The pool, NULL for the shared pool.
+ * @param ustr The UTF-8 string whose characters are to be counted.
+ * @return The total number of characters in the UTF-8 string.
+ */
+size_t utf8_char_count_parallel(utf8_pool* pool, utf8_string ustr);
+
+#endif
@@ -0,0 +1,172 @@
+#include "utf8_position.h"
+#include "utf8_swar.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Distance in bytes between checkpoints of a `utf8_position_index`.
+#define CHECKPOINT_STRIDE 1024
+
+typedef enum {
+    BY_BYTE,
+    BY_CHAR,
+    BY_UTF16,
+} position_key;
+
+static size_t key_of(utf8_position pos, position_key key) {
+    switch (key) {
+    case BY_BYTE: return pos.byte_offset;
+    case BY_CHAR: return pos.char_index;
+    case BY_UTF16: return pos.utf16_offset;
+    }
+    return 0; // unreachable
+}
+
+// Walks forward from `pos`, a character boundary, to the start of the character at `target` (in `key` units),
+// or to the end of the text. A byte target must be a character boundary.
+static utf8_position walk(const char* str, size_t byte_len, utf8_position pos, position_key key, size_t target) {
+    // whole words, as long as they do not go past the target
+    while (byte_len - pos.byte_offset >= 8) {
+        uint64_t word = load_word(str + pos.byte_offset);
+        size_t chars = count_char_starts_in_word(word);
+        size_t units = chars + count_four_byte_leads_in_word(word); // 4 byte characters take 2 UTF-16 code units
+
+        utf8_position next = { pos.byte_offset + 8, pos.char_index + chars, pos.utf16_offset + units };
+        if (key_of(next, key) > target) break;
+        pos = next;
+    }
+
+    // then byte by byte: after a whole word the position may be inside a character, whose lead was already counted
+    for (; pos.byte_offset < byte_len; pos.byte_offset++) {
+        uint8_t byte = (uint8_t)str[pos.byte_offset];
+        if (!is_char_start(byte)) continue;
+
+        size_t units = byte >= 0b11110000 ? 2 : 1;
+        if (key == BY_BYTE ? pos.byte_offset >= target : key == BY_CHAR ? pos.char_index >= target : pos.utf16_offset + units > target)
+            break;
+        pos.char_index++;
+        pos.utf16_offset += units;
+    }
+    return pos;
+}
+
+// Rounds a byte offset down to the start of its character and clamps it to the end of the text.
+static size_t char_boundary_at_or_before(const char* str, size_t byte_len, size_t byte_offset) {
+    if (byte_offset >= byte_len) return byte_len;
+    while (byte_offset > 0 && !is_char_start((uint8_t)str[byte_offset])) byte_offset--;
+    return byte_offset;
+}
+
+static const utf8_position start_position = { 0, 0, 0 };
+
+utf8_position utf8_position_at_byte(utf8_string ustr, size_t byte_offset) {
+    if (ustr.str == NULL) return start_position;
+    size_t target = char_boundary_at_or_before(ustr.str, ustr.byte_len, byte_offset);
+    return walk(ustr.str, ustr.byte_len, start_position, BY_BYTE, target);
+}
+
+utf8_position utf8_position_at_char(utf8_string ustr, size_t char_index) {
+    if (ustr.str == NULL) return start_position;
+    return walk(ustr.str, ustr.byte_len, start_position, BY_CHAR, char_index);
+}
+
+utf8_position utf8_position_at_utf16(utf8_string ustr, size_t utf16_offset) {
+    if (ustr.str == NULL) return start_position;
+    return walk(ustr.str, ustr.byte_len, start_position, BY_UTF16, utf16_offset);
+}
+
+utf8_position_index make_utf8_position_index(utf8_string ustr) {
+    if (ustr.str == NULL) ustr = (utf8_string) { .str = "", .byte_len = 0 };
+    utf8_position_index index = { .text = ustr };
+
+    size_t lines = 1;
+    for (const char* nl = ustr.str; (nl = memchr(nl, '\n', ustr.str + ustr.byte_len - nl)) != NULL; nl++) lines++;
+
+    index.checkpoints = malloc((ustr.byte_len / CHECKPOINT_STRIDE + 1) * sizeof(utf8_position));
+    index.line_starts = malloc(lines * sizeof(utf8_position));
+    if (!index.checkpoints || !index.line_starts) {
+        free_utf8_position_index(&index);
+        return index;
+    }
+
+    // a checkpoint at the first character boundary at or before every multiple of the stride
+    utf8_position pos = start_position;
+    for (size_t offset = 0; offset < ustr.byte_len || offset == 0; offset += CHECKPOINT_STRIDE) {
+        size_t target = char_boundary_at_or_before(ustr.str, ustr.byte_len, offset);
+        pos = walk(ustr.str, ustr.byte_len, pos, BY_BYTE, target);
+        index.checkpoints[index.checkpoint_count++] = pos;
+    }
+
+    // line starts, walking from the nearest checkpoint
+    index.line_starts[index.line_count++] = start_position;
+    for (const char* nl = ustr.str; (nl = memchr(nl, '\n', ustr.str + ustr.byte_len - nl)) != NULL; nl++)
+        index.line_starts[index.line_count++] = indexed_utf8_position_at_byte(&index, (size_t)(nl - ustr.str) + 1);
+
+    return index;
+}
+
+void free_utf8_position_index(utf8_position_index* index) {
+    free(index->checkpoints);
+    free(index->line_starts);
+    index->checkpoints = NULL;
+    index->line_starts = NULL;
+    index->checkpoint_count = 0;
+    index->line_count = 0;
+}
+
+// Index of the last position of `positions` whose `key` is at most `target` (positions[0] is the start).
+static size_t last_at_or_before(const utf8_position* positions, size_t count, position_key key, size_t target) {
+    size_t lo = 0, hi = count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (key_of(positions[mid], key) <= target) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static utf8_position indexed_walk(const utf8_position_index* index, position_key key, size_t target) {
+    size_t i = last_at_or_before(index->checkpoints, index->checkpoint_count, key, target);
+    return walk(index->text.str, index->text.byte_len, index->checkpoints[i], key, target);
+}
+
+utf8_position indexed_utf8_position_at_byte(const utf8_position_index* index, size_t byte_offset) {
+    return indexed_walk(index, BY_BYTE, char_boundary_at_or_before(index->text.str, index->text.byte_len, byte_offset));
+}
+
+utf8_position indexed_utf8_position_at_char(const utf8_position_index* index, size_t char_index) {
+    return indexed_walk(index, BY_CHAR, char_index);
+}
+
+utf8_position indexed_utf8_position_at_utf16(const utf8_position_index* index, size_t utf16_offset) {
+    return indexed_walk(index, BY_UTF16, utf16_offset);
+}
+
+size_t indexed_utf8_char_index_of(const utf8_position_index* index, size_t byte_offset) {
+    return indexed_utf8_position_at_byte(index, byte_offset).char_index;
+}
+
+utf8_position utf8_line_start(const utf8_position_index* index, size_t line) {
+    return index->line_starts[line < index->line_count ? line : index->line_count - 1];
+}
+
+size_t utf8_line_of(const utf8_position_index* index, size_t byte_offset) {
+    return last_at_or_before(index->line_starts, index->line_count, BY_BYTE, byte_offset);
+}
+
+utf8_position utf8_position_at_line_utf16(const utf8_position_index* index, size_t line, size_t utf16_column) {
+    if (line >= index->line_count) line = index->line_count - 1;
+    utf8_position start = index->line_starts[line];
+
+    // the end of the line is its '\n' (1 byte, character and code unit before the next line), or the end of the text
+    utf8_position end;
+    if (line + 1 < index->line_count) {
+        utf8_position next = index->line_starts[line + 1];
+        end = (utf8_position) { next.byte_offset - 1, next.char_index - 1, next.utf16_offset - 1 };
+    } else {
+        end = indexed_utf8_position_at_byte(index, index->text.byte_len);
+    }
+
+    if (utf16_column >= end.utf16_offset - start.utf16_offset) return end;
+    return indexed_utf8_position_at_utf16(index, start.utf16_offset + utf16_column);
+}
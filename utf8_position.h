@@ -0,0 +1,129 @@
+/**
+ * @file utf8_position.h
+ * @brief converting positions in UTF-8 text between byte offsets, character indices and UTF-16 offsets (e.g. for LSP)
+ *
+ * @code
+ * #include "utf8_position.h"
+ *
+ * // an LSP position { line, character } (UTF-16 code units) to a byte offset into the UTF-8 buffer
+ * utf8_position_index index = make_utf8_position_index(text);
+ * size_t byte_offset = utf8_position_at_line_utf16(&index, position.line, position.character).byte_offset;
+ *
+ * // and back
+ * size_t line = utf8_line_of(&index, byte_offset);
+ * size_t character = indexed_utf8_position_at_byte(&index, byte_offset).utf16_offset - utf8_line_start(&index, line).utf16_offset;
+ * free_utf8_position_index(&index);
+ * @endcode
+ */
+
+#ifndef ZAHASH_UTF8_POSITION_H
+#define ZAHASH_UTF8_POSITION_H
+
+#include "utf8.h"
+
+/**
+ * @brief A position in UTF-8 text, counted three ways from the start of the text.
+ */
+typedef struct {
+    size_t byte_offset;     ///< Offset in UTF-8 bytes.
+    size_t char_index;      ///< Index in characters (code points).
+    size_t utf16_offset;    ///< Offset in UTF-16 code units: characters beyond U+FFFF count as 2 (a surrogate pair).
+} utf8_position;
+
+/**
+ * @brief Finds the position of the character at byte offset `byte_offset` in one pass over the bytes before it.
+ *
+ * @details Character starts and 4 byte characters (the UTF-16 surrogate pairs) are counted 8 bytes at a time.
+ *          The text is bounded by `ustr.byte_len` only: '\0' bytes are characters like any other.
+ *          The text must be valid UTF-8.
+ *
+ * @param ustr The text.
+ * @param byte_offset The byte offset. An offset inside a character is rounded down to the start of the character,
+ *        an offset beyond the end of the text is clamped to the end.
+ * @return The position.
+ */
+utf8_position utf8_position_at_byte(utf8_string ustr, size_t byte_offset);
+
+/**
+ * @brief Same as `utf8_position_at_byte`, for the start of the character with index `char_index`.
+ */
+utf8_position utf8_position_at_char(utf8_string ustr, size_t char_index);
+
+/**
+ * @brief Same as `utf8_position_at_byte`, for UTF-16 offset `utf16_offset`.
+ *        An offset between the two halves of a surrogate pair is rounded down to the start of the character.
+ */
+utf8_position utf8_position_at_utf16(utf8_string ustr, size_t utf16_offset);
+
+/**
+ * @brief Positions of checkpoints and line starts of a text, so that conversions only walk a short distance.
+ *
+ * @details There is a checkpoint about every kilobyte, and the position of the start of every line (after every '\n')
+ *          for conversions from and to lines. The index refers to the text, which must outlive it and not change.
+ */
+typedef struct {
+    utf8_string text;               ///< The indexed text.
+    utf8_position* checkpoints;     ///< Positions of character boundaries about every kilobyte, starting at 0.
+    size_t checkpoint_count;        ///< Number of checkpoints.
+    utf8_position* line_starts;     ///< Position of the start of every line, starting at 0.
+    size_t line_count;              ///< Number of lines: one more than the number of '\n' in the text.
+} utf8_position_index;
+
+/**
+ * @brief Indexes a text in O(n) time, using about 2.5% of its size for the checkpoints and 24 bytes per line.
+ *
+ * @param ustr The text, which must be valid UTF-8.
+ * @return The index, or an index with NULL `checkpoints` if memory ran out.
+ *         The caller is responsible for freeing it with `free_utf8_position_index`.
+ */
+utf8_position_index make_utf8_position_index(utf8_string ustr);
+
+/**
+ * @brief Frees the memory of an index.
+ */
+void free_utf8_position_index(utf8_position_index* index);
+
+/**
+ * @brief Same as `utf8_position_at_byte`, walking from the nearest checkpoint before `byte_offset` (O(log n) time).
+ */
+utf8_position indexed_utf8_position_at_byte(const utf8_position_index* index, size_t byte_offset);
+
+/**
+ * @brief Same as `utf8_position_at_char`, walking from the nearest checkpoint before `char_index` (O(log n) time).
+ */
+utf8_position indexed_utf8_position_at_char(const utf8_position_index* index, size_t char_index);
+
+/**
+ * @brief Same as `utf8_position_at_utf16`, walking from the nearest checkpoint before `utf16_offset` (O(log n) time).
+ */
+utf8_position indexed_utf8_position_at_utf16(const utf8_position_index* index, size_t utf16_offset);
+
+/**
+ * @brief Same as `utf8_char_index_of`, walking from the nearest checkpoint before `byte_offset` (O(log n) time).
+ */
+size_t indexed_utf8_char_index_of(const utf8_position_index* index, size_t byte_offset);
+
+/**
+ * @brief The position of the start of line `line` (zero-based), clamped to the last line.
+ */
+utf8_position utf8_line_start(const utf8_position_index* index, size_t line);
+
+/**
+ * @brief The (zero-based) line of the character at byte offset `byte_offset`, by binary search over the line starts.
+ */
+size_t utf8_line_of(const utf8_position_index* index, size_t byte_offset);
+
+/**
+ * @brief Converts a line and a UTF-16 column (an LSP `Position`) to a position in the text.
+ *
+ * @details The line is clamped to the last line, and the column to the end of the line (its '\n' excluded),
+ *          like LSP asks of positions beyond the line length.
+ *
+ * @param index The index of the text.
+ * @param line The zero-based line.
+ * @param utf16_column The offset in UTF-16 code units from the start of the line.
+ * @return The position.
+ */
+utf8_position utf8_position_at_line_utf16(const utf8_position_index* index, size_t line, size_t utf16_column);
+
+#endif
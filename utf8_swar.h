@@ -0,0 +1,97 @@
+/**
+ * @file utf8_swar.h
+ * @brief internal helpers that look at 8 bytes at a time in a 64 bit word (SIMD within a register)
+ *
+ * @details Shared by the library's sources, not part of its API. Words are loaded with `memcpy`, so any alignment
+ *          works, and the per-byte results are exact because no carry crosses from one byte into the next.
+ */
+
+#ifndef ZAHASH_UTF8_SWAR_H
+#define ZAHASH_UTF8_SWAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOW_BITS 0x0101010101010101ULL
+#define HIGH_BITS 0x8080808080808080ULL
+#define LOW7_BITS 0x7F7F7F7F7F7F7F7FULL
+
+static inline uint64_t load_word(const char* str) {
+    uint64_t word;
+    memcpy(&word, str, sizeof(word));
+    return word;
+}
+
+// High bit set in some byte if the word has a '\0' byte (exact as a whole, not per byte).
+static inline uint64_t has_zero_byte(uint64_t word) {
+    return (word - LOW_BITS) & ~word & HIGH_BITS;
+}
+
+// High bit set in some byte if the word has a byte equal to `byte` (exact as a whole, not per byte).
+static inline uint64_t has_byte(uint64_t word, uint8_t byte) {
+    return has_zero_byte(word ^ (LOW_BITS * byte));
+}
+
+// High bit set in every byte of `word` that is at least `min`, for `min` >= 0x80.
+static inline uint64_t bytes_at_least(uint64_t word, uint8_t min) {
+    return ((word & LOW7_BITS) + LOW_BITS * (0x100 - min)) & word & HIGH_BITS;
+}
+
+// Number of bytes of `word` that start a character (those that are not continuation bytes 10xxxxxx).
+static inline size_t count_char_starts_in_word(uint64_t word) {
+    return 8 - (size_t)__builtin_popcountll(word & ~(word << 1) & HIGH_BITS);
+}
+
+// Number of bytes of `word` that start a 4 byte character (11110xxx).
+static inline size_t count_four_byte_leads_in_word(uint64_t word) {
+    return (size_t)__builtin_popcountll(word & (word << 1) & (word << 2) & (word << 3) & HIGH_BITS);
+}
+
+static inline bool is_char_start(uint8_t byte) {
+    return (byte & 0b11000000) != 0b10000000;
+}
+
+// Byte length of a character from its lead byte, 0 if it is not a lead byte.
+static inline uint8_t utf8_lead_byte_len(uint8_t lead) {
+    if ((lead & 0b10000000) == 0b00000000) return 1;
+    if ((lead & 0b11100000) == 0b11000000) return 2;
+    if ((lead & 0b11110000) == 0b11100000) return 3;
+    if ((lead & 0b11111000) == 0b11110000) return 4;
+    return 0;
+}
+
+// Byte length of the UTF-8 encoding of a code point.
+static inline size_t utf8_len_of(uint32_t code_point) {
+    if (code_point < 0x80) return 1;
+    if (code_point < 0x800) return 2;
+    if (code_point < 0x10000) return 3;
+    return 4;
+}
+
+// Writes the UTF-8 encoding of a code point to `out`, which must have room for it, and returns its byte length.
+static inline size_t put_utf8(char* out, uint32_t code_point) {
+    switch (utf8_len_of(code_point)) {
+    case 1:
+        out[0] = (char)code_point;
+        return 1;
+    case 2:
+        out[0] = (char)(0b11000000 | code_point >> 6);
+        out[1] = (char)(0b10000000 | (code_point & 0b00111111));
+        return 2;
+    case 3:
+        out[0] = (char)(0b11100000 | code_point >> 12);
+        out[1] = (char)(0b10000000 | ((code_point >> 6) & 0b00111111));
+        out[2] = (char)(0b10000000 | (code_point & 0b00111111));
+        return 3;
+    default:
+        out[0] = (char)(0b11110000 | code_point >> 18);
+        out[1] = (char)(0b10000000 | ((code_point >> 12) & 0b00111111));
+        out[2] = (char)(0b10000000 | ((code_point >> 6) & 0b00111111));
+        out[3] = (char)(0b10000000 | (code_point & 0b00111111));
+        return 4;
+    }
+}
+
+#endif
@@ -0,0 +1,397 @@
+#include "utf8.h"
+#include "utf8_io.h"
+#include "utf8_swar.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE (1 << 20)
+
+// exit statuses
+#define EXIT_VALID 0
+#define EXIT_INVALID 1
+#define EXIT_ERROR 2
+
+typedef enum {
+    OUT_UTF16LE,
+    OUT_UTF16BE,
+    OUT_UTF32LE,
+    OUT_UTF32BE,
+} output_encoding;
+
+typedef struct stream stream;
+
+// Handles one block of input. `block` starts at byte `offset` of the input and ends with '\0' at `block[len]`.
+// Returns the number of bytes consumed; the rest (an incomplete trailing character) is handed back
+// in front of the next block. Sets `s->status` to stop the stream (EXIT_ERROR if writing the output failed).
+typedef size_t (*block_handler)(stream* s, const char* block, size_t len, size_t offset, bool final);
+
+struct stream {
+    const char* path;
+    int status;
+    bool quiet;
+    FILE* out;
+
+    // offset of the first invalid byte
+    utf8_validity validity;
+
+    // count
+    size_t chars;
+    size_t lines;
+
+    // sanitize
+    size_t replacements;
+
+    // transcode
+    output_encoding encoding;
+};
+
+static void report_invalid(stream* s, size_t offset) {
+    s->validity = (utf8_validity) { .valid = false, .valid_upto = offset };
+    s->status = EXIT_INVALID;
+}
+
+// true if the block is cut in the middle of a character at `offset` and the rest of it is still to come
+static bool is_cut_char(const char* block, size_t len, size_t offset, bool final) {
+    return !final && utf8_incomplete_suffix_len(block, len) == len - offset;
+}
+
+// appends a code unit of `size` bytes to `out`, returns the new length
+static size_t put_unit(uint8_t* out, size_t len, uint32_t unit, size_t size, bool big_endian) {
+    for (size_t i = 0; i < size; i++) {
+        size_t shift = big_endian ? (size - 1 - i) * 8 : i * 8;
+        out[len++] = (uint8_t)(unit >> shift);
+    }
+    return len;
+}
+
+// Writes to the output. If that fails (e.g. the disk is full) it reports why and stops the stream.
+static bool write_output(stream* s, const void* data, size_t len) {
+    if (fwrite(data, 1, len, s->out) == len) return true;
+    fprintf(stderr, "utf8tool: stdout: %s\n", strerror(errno));
+    s->status = EXIT_ERROR;
+    return false;
+}
+
+static size_t transcode_block(stream* s, const char* block, size_t len, size_t offset, bool final) {
+    utf8_validity validity = validate_utf8_n(block, len);
+    size_t valid_len = validity.valid_upto;
+    if (!validity.valid && !is_cut_char(block, len, valid_len, final)) report_invalid(s, offset + valid_len);
+
+    bool big_endian = s->encoding == OUT_UTF16BE || s->encoding == OUT_UTF32BE;
+    bool utf16 = s->encoding == OUT_UTF16LE || s->encoding == OUT_UTF16BE;
+
+    // every character takes at most 4 output bytes
+    uint8_t out[4096];
+    size_t out_len = 0;
+
+    for (size_t i = 0; i < valid_len;) {
+        utf8_char ch = { .str = block + i, .byte_len = utf8_lead_byte_len((uint8_t)block[i]) };
+        uint32_t cp = unicode_code_point(ch);
+        i += ch.byte_len;
+
+        if (!utf16) out_len = put_unit(out, out_len, cp, 4, big_endian);
+        else if (cp < 0x10000) out_len = put_unit(out, out_len, cp, 2, big_endian);
+        else {
+            cp -= 0x10000;
+            out_len = put_unit(out, out_len, 0xD800 | (cp >> 10), 2, big_endian);
+            out_len = put_unit(out, out_len, 0xDC00 | (cp & 0x3FF), 2, big_endian);
+        }
+
+        if (out_len > sizeof(out) - 4) {
+            if (!write_output(s, out, out_len)) return valid_len;
+            out_len = 0;
+        }
+    }
+    write_output(s, out, out_len);
+
+    return valid_len;
+}
+
+static int open_input(const stream* s) {
+    int fd = strcmp(s->path, "-") == 0 ? STDIN_FILENO : open(s->path, O_RDONLY);
+    if (fd < 0) fprintf(stderr, "utf8tool: %s: %s\n", s->path, strerror(errno));
+    return fd;
+}
+
+static void close_input(int fd) {
+    if (fd != STDIN_FILENO) close(fd);
+}
+
+// validate and count go through the file API, which maps regular files instead of reading them
+static long long run_validate(stream* s) {
+    int fd = open_input(s);
+    if (fd < 0) return -1;
+
+    utf8_file_validity result = validate_utf8_fd(fd);
+    close_input(fd);
+
+    if (result.error) {
+        fprintf(stderr, "utf8tool: %s: %s\n", s->path, strerror(result.error));
+        return -1;
+    }
+    if (!result.validity.valid) report_invalid(s, result.validity.valid_upto);
+    return (long long)result.byte_len;
+}
+
+static long long run_count(stream* s) {
+    int fd = open_input(s);
+    if (fd < 0) return -1;
+
+    utf8_file_stats result = scan_utf8_fd(fd);
+    close_input(fd);
+
+    if (result.error) {
+        fprintf(stderr, "utf8tool: %s: %s\n", s->path, strerror(result.error));
+        return -1;
+    }
+    if (!result.stats.validity.valid) report_invalid(s, result.stats.validity.valid_upto);
+    s->chars = result.stats.char_count;
+    s->lines = result.stats.line_count;
+    return (long long)result.byte_len;
+}
+
+// sanitize writes clean regions straight from the read buffer, bypassing stdio
+static long long run_sanitize(stream* s) {
+    int fd = open_input(s);
+    if (fd < 0) return -1;
+
+    // keep the order with anything already buffered on stdout
+    if (fflush(s->out) != 0) {
+        fprintf(stderr, "utf8tool: stdout: %s\n", strerror(errno));
+        close_input(fd);
+        return -1;
+    }
+    utf8_sanitize_result result = sanitize_utf8_fd(fd, fileno(s->out));
+    close_input(fd);
+
+    if (result.error) {
+        fprintf(stderr, "utf8tool: %s: %s\n", s->path, strerror(result.error));
+        return -1;
+    }
+    s->replacements = result.replacements;
+    return (long long)result.bytes_read;
+}
+
+// Streams the file at `path` ("-" for stdin) through `handler` in BLOCK_SIZE blocks.
+// Returns the number of bytes read, or -1 on I/O error.
+static long long run_stream(stream* s, block_handler handler) {
+    int fd = open_input(s);
+    if (fd < 0) return -1;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // larger kernel read-ahead, fails harmlessly on pipes
+#endif
+
+    // room for the carried incomplete character in front and the terminating '\0' behind
+    char* buffer = malloc(BLOCK_SIZE + 4 + 1);
+    if (!buffer) {
+        fprintf(stderr, "utf8tool: out of memory\n");
+        close_input(fd);
+        return -1;
+    }
+
+    size_t carried = 0;
+    size_t offset = 0;  // input offset of buffer[0]
+    long long total = 0;
+
+    while (s->status == EXIT_VALID) {
+        ssize_t n = read(fd, buffer + carried, BLOCK_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "utf8tool: %s: %s\n", s->path, strerror(errno));
+            total = -1;
+            break;
+        }
+
+        total += n;
+        size_t len = carried + (size_t)n;
+        bool final = n == 0;
+        buffer[len] = '\0';
+
+        size_t consumed = handler(s, buffer, len, offset, final);
+        if (final) break;
+
+        carried = len - consumed;
+        memmove(buffer, buffer + consumed, carried);
+        offset += consumed;
+    }
+
+    free(buffer);
+    close_input(fd);
+    return total;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report_throughput(const stream* s, long long bytes, double seconds) {
+    if (s->quiet || bytes < 0) return;
+    fprintf(stderr, "utf8tool: %s: %lld bytes in %.3f s (%.1f MB/s)\n",
+        s->path, bytes, seconds, seconds > 0 ? (double)bytes / seconds / 1e6 : 0.0);
+}
+
+// Several files are validated at once, overlapping their reads through validate_utf8_files.
+// Returns the exit status.
+static int validate_many(const char** paths, int npaths, bool quiet) {
+    utf8_file_validity* results = malloc((size_t)npaths * sizeof(utf8_file_validity));
+    if (!results) {
+        fprintf(stderr, "utf8tool: out of memory\n");
+        return EXIT_ERROR;
+    }
+
+    double start = now_seconds();
+    int error = validate_utf8_files(paths, (size_t)npaths, default_utf8_bulk_config(), results);
+    double seconds = now_seconds() - start;
+    if (error) {
+        fprintf(stderr, "utf8tool: %s\n", strerror(error));
+        free(results);
+        return EXIT_ERROR;
+    }
+
+    int exit_status = EXIT_VALID;
+    long long bytes = 0;
+    for (int i = 0; i < npaths; i++) {
+        if (results[i].error) {
+            fprintf(stderr, "utf8tool: %s: %s\n", paths[i], strerror(results[i].error));
+            exit_status = EXIT_ERROR;
+            continue;
+        }
+
+        bytes += (long long)results[i].byte_len;
+        if (results[i].validity.valid) {
+            printf("%s: valid\n", paths[i]);
+        } else {
+            fprintf(stderr, "utf8tool: %s: invalid UTF-8 at byte offset %zu\n", paths[i], results[i].validity.valid_upto);
+            if (exit_status == EXIT_VALID) exit_status = EXIT_INVALID;
+        }
+    }
+
+    stream total = { .path = "total", .quiet = quiet };
+    report_throughput(&total, bytes, seconds);
+
+    free(results);
+    return exit_status;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: utf8tool [-q] <command> [options] [file...]\n"
+        "\n"
+        "commands:\n"
+        "  validate             check that every file is valid UTF-8\n"
+        "  count                print lines, characters and bytes of every file (like wc -lmc)\n"
+        "  sanitize             write the files to stdout, replacing invalid sequences with U+FFFD\n"
+        "  transcode -t ENC     write the files to stdout as utf16le, utf16be, utf32le or utf32be\n"
+        "\n"
+        "Files default to stdin ('-'). Throughput is reported on stderr unless -q is given.\n"
+        "Exits with 1 (and the byte offset of the first error) on invalid input, 2 on usage or I/O errors.\n");
+}
+
+int main(int argc, char** argv) {
+    bool quiet = false;
+    int arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "-q") == 0) {
+        quiet = true;
+        arg++;
+    }
+    if (arg >= argc) {
+        usage();
+        return EXIT_ERROR;
+    }
+
+    const char* command = argv[arg++];
+    long long (*run)(stream* s) = NULL;
+    block_handler handler = NULL;
+    output_encoding encoding = OUT_UTF16LE;
+
+    if (strcmp(command, "validate") == 0) run = run_validate;
+    else if (strcmp(command, "count") == 0) run = run_count;
+    else if (strcmp(command, "sanitize") == 0) run = run_sanitize;
+    else if (strcmp(command, "transcode") == 0) {
+        handler = transcode_block;
+        if (arg + 1 >= argc || strcmp(argv[arg], "-t") != 0) {
+            usage();
+            return EXIT_ERROR;
+        }
+        const char* name = argv[arg + 1];
+        if (strcmp(name, "utf16le") == 0) encoding = OUT_UTF16LE;
+        else if (strcmp(name, "utf16be") == 0) encoding = OUT_UTF16BE;
+        else if (strcmp(name, "utf32le") == 0) encoding = OUT_UTF32LE;
+        else if (strcmp(name, "utf32be") == 0) encoding = OUT_UTF32BE;
+        else {
+            usage();
+            return EXIT_ERROR;
+        }
+        arg += 2;
+    } else {
+        usage();
+        return EXIT_ERROR;
+    }
+
+    static char out_buffer[BLOCK_SIZE];
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+
+    const char* stdin_only[] = { "-" };
+    const char** paths = arg < argc ? (const char**)argv + arg : stdin_only;
+    int npaths = arg < argc ? argc - arg : 1;
+    int exit_status = EXIT_VALID;
+    bool output_failed = false;  // already reported
+
+    bool from_stdin = false;
+    for (int i = 0; i < npaths; i++) from_stdin = from_stdin || strcmp(paths[i], "-") == 0;
+    if (run == run_validate && npaths > 1 && !from_stdin) {
+        exit_status = validate_many(paths, npaths, quiet);
+        npaths = 0;
+    }
+
+    for (int i = 0; i < npaths; i++) {
+        stream s = {
+            .path = paths[i],
+            .status = EXIT_VALID,
+            .quiet = quiet,
+            .out = stdout,
+            .validity = { .valid = true, .valid_upto = 0 },
+            .encoding = encoding,
+        };
+
+        double start = now_seconds();
+        long long bytes = run ? run(&s) : run_stream(&s, handler);
+        double seconds = now_seconds() - start;
+
+        if (bytes < 0 || s.status == EXIT_ERROR) {
+            output_failed = output_failed || s.status == EXIT_ERROR;
+            exit_status = EXIT_ERROR;
+            continue;
+        }
+
+        if (s.status == EXIT_INVALID) {
+            fprintf(stderr, "utf8tool: %s: invalid UTF-8 at byte offset %zu\n", s.path, s.validity.valid_upto);
+            if (exit_status == EXIT_VALID) exit_status = EXIT_INVALID;
+        } else if (run == run_validate) {
+            printf("%s: valid\n", s.path);
+        } else if (run == run_count) {
+            printf("%zu %zu %lld %s\n", s.lines, s.chars, bytes, s.path);
+        } else if (run == run_sanitize && !quiet) {
+            fprintf(stderr, "utf8tool: %s: %zu replacement(s)\n", s.path, s.replacements);
+        }
+
+        report_throughput(&s, bytes, seconds);
+    }
+
+    // a write that failed earlier leaves the error indicator set, even if nothing is left to flush
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        if (!output_failed) fprintf(stderr, "utf8tool: stdout: %s\n", strerror(errno));
+        return EXIT_ERROR;
+    }
+    return exit_status;
+}